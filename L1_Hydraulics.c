@@ -0,0 +1,1085 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <math.h>
+#include "epanet2.h"
+#include "L1_Hydraulics.h"
+
+//Linearized network model used for the analytic sensitivity mode. A link
+//	with head loss h(Q) contributes the conductance 1/h'(Q) between its end
+//	nodes, tanks and reservoirs are fixed heads. For a leak of emitter
+//	coefficient C at junction j the extra outflow is C p_j^gamma, so to first
+//	order the heads drop by G^-1 e_j C p_j^gamma, G being the conductance
+//	matrix over the junctions
+
+#define HAZEN_WILLIAMS_EXPONENT 1.852
+//Smallest head loss gradient, as EPANET's RQtol, keeps links carrying next
+//	to no flow from having an infinite conductance
+#define MIN_GRADIENT 1.0e-7
+//Psi per foot of water
+#define PSI_PER_FOOT 0.4333
+
+//FUNCTION
+//Head loss formula of the open network, HEADLOSS_HW, HEADLOSS_DW or 
+//	HEADLOSS_CM, or -1 if it cannot be told. EPANET 2.2 reports it, the 2.0 
+//	toolkit has no option for it, so there the Headloss line of the 
+//	[OPTIONS] section of inputFile is read the way EPANET reads it, 
+//	keywords matched on their leading letters and H-W when there is none
+int headlossFormula(const char *inputFile)
+{
+#ifdef EPANET_2_2
+	float formula;
+
+	(void)inputFile;
+	if (ENgetoption(EN_HEADLOSSFORM, &formula) != 0)
+		return -1;
+	return (int)formula;
+#else
+	FILE *file;
+	char line[1024], keyword[64], value[64];
+	int options, formula, count;
+
+	file = fopen(inputFile, "r");
+	if (!file)
+		return -1;
+
+	options = 0;
+	formula = HEADLOSS_HW;
+	while (fgets(line, sizeof(line), file))
+	{
+		count = sscanf(line, " %63s %63s", keyword, value);
+		if (count < 1 || keyword[0] == ';')
+			continue;
+		if (keyword[0] == '[')
+		{
+			options = (strncasecmp(keyword, "[OPTI", 5) == 0);
+			continue;
+		}
+		if (!options || strncasecmp(keyword, "HEADL", 5) != 0)
+			continue;
+
+		if (count < 2)
+			formula = -1;
+		else if (strncasecmp(value, "H-W", 3) == 0)
+			formula = HEADLOSS_HW;
+		else if (strncasecmp(value, "D-W", 3) == 0)
+			formula = HEADLOSS_DW;
+		else if (strncasecmp(value, "C-M", 3) == 0)
+			formula = HEADLOSS_CM;
+		else
+			formula = -1;
+	}
+
+	fclose(file);
+	return formula;
+#endif
+}
+
+//FUNCTION
+//Pipe head loss exponent, Darcy-Weisbach and Chezy-Manning losses go with
+//	the square of the flow
+static double headlossExponent(int formula)
+{
+	return (formula == HEADLOSS_HW) ? HAZEN_WILLIAMS_EXPONENT : 2.0;
+}
+
+//FUNCTION
+//Build and factor the conductance matrix of the junctions from the heads
+//	and flows of the last hydraulic solution. Pumps are taken as following a
+//	single point curve through their operating point, open valves as a minor
+//	loss. formula is the network's headlossFormula. Returns non-zero if it 
+//	is not known or the matrix is not positive definite, which means some 
+//	junction has no open path to a tank or reservoir
+int linearizeNetwork(NetworkLinearization *lin, int numNodes, int formula)
+{
+	int i, j, k, linkCount, from, to, type, units;
+	float value, head, elevation, fromHead, toHead;
+	double exponent, gradient, conductance, flow, loss, *cj, *ck;
+
+	freeLinearization(lin);
+
+	if (formula < 0)
+		return 1;
+	if (createMatrix(&lin->factor, numNodes, numNodes, 0) != 0)
+		return 1;
+	lin->nodes = numNodes;
+	lin->pressure = (double *) calloc(numNodes, sizeof(double));
+	lin->work = (double *) calloc(numNodes, sizeof(double));
+	lin->pressureRatio = 0.0;
+
+	ENgetoption(EN_EMITEXPON, &value);
+	lin->emitterExponent = value;
+
+	for (i = 1; i <= numNodes; i++)
+	{
+		ENgetnodevalue(i, EN_PRESSURE, &value);
+		ENgetnodevalue(i, EN_HEAD, &head);
+		ENgetnodevalue(i, EN_ELEVATION, &elevation);
+		lin->pressure[i-1] = value;
+		if (lin->pressureRatio == 0.0 && fabs(head - elevation) > 1.0e-3)
+			lin->pressureRatio = value / (head - elevation);
+	}
+	if (lin->pressureRatio == 0.0)
+	{
+		ENgetflowunits(&units);
+		lin->pressureRatio = (units <= EN_AFD) ? PSI_PER_FOOT : 1.0;
+	}
+
+	exponent = headlossExponent(formula);
+	ENgetcount(EN_LINKCOUNT, &linkCount);
+
+	for (k = 1; k <= linkCount; k++)
+	{
+		ENgetlinkvalue(k, EN_STATUS, &value);
+		if (value == 0.0)
+			continue;
+
+		ENgetlinktype(k, &type);
+		ENgetlinknodes(k, &from, &to);
+		ENgetlinkvalue(k, EN_FLOW, &value);
+		ENgetnodevalue(from, EN_HEAD, &fromHead);
+		ENgetnodevalue(to, EN_HEAD, &toHead);
+
+		flow = fabs(value);
+		loss = fabs(fromHead - toHead);
+
+		gradient = MIN_GRADIENT;
+		if (flow > MIN_GRADIENT)
+		{
+			if (type == EN_PUMP)
+				gradient = (2.0 / 3.0) * loss / flow;
+			else if (type <= EN_PIPE)
+				gradient = exponent * loss / flow;
+			else
+				gradient = 2.0 * loss / flow;
+		}
+		if (gradient < MIN_GRADIENT)
+			gradient = MIN_GRADIENT;
+		conductance = 1.0 / gradient;
+
+		if (from <= numNodes)
+			MATRIX(lin->factor, from-1, from-1) += conductance;
+		if (to <= numNodes)
+			MATRIX(lin->factor, to-1, to-1) += conductance;
+		if (from <= numNodes && to <= numNodes)
+		{
+			MATRIX(lin->factor, from-1, to-1) -= conductance;
+			MATRIX(lin->factor, to-1, from-1) -= conductance;
+		}
+	}
+
+	//Emitters already in the network discharge more as the head rises
+	for (i = 1; i <= numNodes; i++)
+	{
+		ENgetnodevalue(i, EN_EMITTER, &value);
+		if (value > 0.0 && lin->pressure[i-1] > 0.0)
+		{
+			MATRIX(lin->factor, i-1, i-1) += value * lin->emitterExponent *
+				pow(lin->pressure[i-1], lin->emitterExponent - 1.0) *
+				lin->pressureRatio;
+		}
+	}
+
+	//Left looking Cholesky, only the lower triangle is used afterwards
+	for (j = 0; j < numNodes; j++)
+	{
+		cj = MATRIX_COLUMN(lin->factor, j);
+		for (k = 0; k < j; k++)
+		{
+			ck = MATRIX_COLUMN(lin->factor, k);
+			if (ck[j] == 0.0)
+				continue;
+			for (i = j; i < numNodes; i++)
+			{
+				cj[i] -= ck[i] * ck[j];
+			}
+		}
+
+		if (cj[j] <= 0.0)
+		{
+			freeLinearization(lin);
+			return 1;
+		}
+		cj[j] = sqrt(cj[j]);
+		for (i = j + 1; i < numNodes; i++)
+		{
+			cj[i] /= cj[j];
+		}
+	}
+
+	return 0;
+}
+
+//FUNCTION
+//Predicted junction pressures with an emitter of the given coefficient at
+//	node (zero based), to first order about the linearization point
+void linearizedPressures(NetworkLinearization *lin, int node,
+	double emitterCoeff, double *pressures)
+{
+	int i, k, n;
+	double *x, *ck, outflow, sum;
+
+	n = lin->nodes;
+	x = lin->work;
+
+	for (i = 0; i < n; i++)
+	{
+		x[i] = 0.0;
+	}
+	x[node] = 1.0;
+
+	//L y = e_node, nothing above node is touched
+	for (k = node; k < n; k++)
+	{
+		ck = MATRIX_COLUMN(lin->factor, k);
+		x[k] /= ck[k];
+		for (i = k + 1; i < n; i++)
+		{
+			x[i] -= ck[i] * x[k];
+		}
+	}
+
+	//L' x = y
+	for (k = n - 1; k >= 0; k--)
+	{
+		ck = MATRIX_COLUMN(lin->factor, k);
+		sum = x[k];
+		for (i = k + 1; i < n; i++)
+		{
+			sum -= ck[i] * x[i];
+		}
+		x[k] = sum / ck[k];
+	}
+
+	outflow = 0.0;
+	if (lin->pressure[node] > 0.0)
+		outflow = emitterCoeff * pow(lin->pressure[node], lin->emitterExponent);
+
+	for (i = 0; i < n; i++)
+	{
+		pressures[i] = lin->pressure[i] - lin->pressureRatio * outflow * x[i];
+	}
+}
+
+//FUNCTION
+//Release the factor and work arrays
+void freeLinearization(NetworkLinearization *lin)
+{
+	freeMatrix(&lin->factor);
+	free(lin->pressure);
+	free(lin->work);
+	lin->pressure = NULL;
+	lin->work = NULL;
+	lin->nodes = 0;
+}
+
+//Flow units per cfs, in toolkit flow unit order
+static const double flowPerCFS[] = {1.0, 448.831, 0.646317, 0.538171, 
+	1.983471, 28.3168, 1699.01, 2.44657, 101.941, 2446.58};
+
+//Iteration limit of the built-in solver
+#define GGA_MAX_TRIALS 200
+
+#define ENVELOPE(s, i, j) ((s)->envelope[(s)->diagonal[i] - ((i) - (j))])
+
+//FUNCTION
+//Reverse Cuthill-McKee order of the junctions, which keeps the envelope of 
+//	the head equations narrow. Each component is started from a junction of 
+//	lowest degree
+static void orderJunctions(GGASolver *s)
+{
+	int i, j, k, n, v, w, head, tail, start, *degree, *adjacent, *begin, *fill;
+	char *visited;
+	
+	n = s->nodes;
+	degree = (int *) calloc(n, sizeof(int));
+	begin = (int *) calloc(n + 1, sizeof(int));
+	fill = (int *) calloc(n, sizeof(int));
+	visited = (char *) calloc(n, sizeof(char));
+	
+	for (k = 0; k < s->links; k++)
+	{
+		if (s->from[k] < n && s->to[k] < n)
+		{
+			degree[s->from[k]]++;
+			degree[s->to[k]]++;
+		}
+	}
+	for (i = 0; i < n; i++)
+	{
+		begin[i + 1] = begin[i] + degree[i];
+	}
+	adjacent = (int *) malloc((begin[n] + 1) * sizeof(int));
+	for (k = 0; k < s->links; k++)
+	{
+		if (s->from[k] < n && s->to[k] < n)
+		{
+			adjacent[begin[s->from[k]] + fill[s->from[k]]++] = s->to[k];
+			adjacent[begin[s->to[k]] + fill[s->to[k]]++] = s->from[k];
+		}
+	}
+	
+	tail = 0;
+	while (tail < n)
+	{
+		start = -1;
+		for (i = 0; i < n; i++)
+		{
+			if (!visited[i] && (start < 0 || degree[i] < degree[start]))
+				start = i;
+		}
+		
+		visited[start] = 1;
+		head = tail;
+		s->order[tail++] = start;
+		while (head < tail)
+		{
+			v = s->order[head++];
+			j = tail;
+			for (k = begin[v]; k < begin[v + 1]; k++)
+			{
+				w = adjacent[k];
+				if (visited[w])
+					continue;
+				visited[w] = 1;
+				
+				//Neighbours go in by increasing degree
+				for (i = tail; i > j && degree[s->order[i - 1]] > degree[w]; i--)
+				{
+					s->order[i] = s->order[i - 1];
+				}
+				s->order[i] = w;
+				tail++;
+			}
+		}
+	}
+	
+	for (i = 0; i < n / 2; i++)
+	{
+		v = s->order[i];
+		s->order[i] = s->order[n - 1 - i];
+		s->order[n - 1 - i] = v;
+	}
+	for (i = 0; i < n; i++)
+	{
+		s->position[s->order[i]] = i;
+	}
+	
+	free(degree);
+	free(begin);
+	free(fill);
+	free(visited);
+	free(adjacent);
+}
+
+//FUNCTION
+//Lay out the envelope of the head equations in the junction order. Row i 
+//	holds columns first[i] to i, which is also where its Cholesky factor 
+//	fills in, so the layout serves every later factorization
+static void layoutEnvelope(GGASolver *s)
+{
+	int i, k, a, b;
+	long size;
+	
+	for (i = 0; i < s->nodes; i++)
+	{
+		s->first[i] = i;
+	}
+	for (k = 0; k < s->links; k++)
+	{
+		if (s->from[k] < s->nodes && s->to[k] < s->nodes)
+		{
+			a = s->position[s->from[k]];
+			b = s->position[s->to[k]];
+			if (a < b && a < s->first[b])
+				s->first[b] = a;
+			if (b < a && b < s->first[a])
+				s->first[a] = b;
+		}
+	}
+	
+	size = 0;
+	for (i = 0; i < s->nodes; i++)
+	{
+		size += i - s->first[i];
+		s->diagonal[i] = size;
+		size++;
+	}
+	s->envelope = (double *) calloc(size, sizeof(double));
+}
+
+//FUNCTION
+//Factor the assembled envelope in place. Returns non-zero if the head 
+//	equations are not positive definite
+static int factorEnvelope(GGASolver *s)
+{
+	int i, j, k, start;
+	double sum;
+	
+	for (i = 0; i < s->nodes; i++)
+	{
+		for (j = s->first[i]; j < i; j++)
+		{
+			start = (s->first[i] > s->first[j]) ? s->first[i] : s->first[j];
+			sum = ENVELOPE(s, i, j);
+			for (k = start; k < j; k++)
+			{
+				sum -= ENVELOPE(s, i, k) * ENVELOPE(s, j, k);
+			}
+			ENVELOPE(s, i, j) = sum / ENVELOPE(s, j, j);
+		}
+		
+		sum = ENVELOPE(s, i, i);
+		for (k = s->first[i]; k < i; k++)
+		{
+			sum -= ENVELOPE(s, i, k) * ENVELOPE(s, i, k);
+		}
+		if (sum <= 0.0)
+			return 1;
+		ENVELOPE(s, i, i) = sqrt(sum);
+	}
+	
+	return 0;
+}
+
+//FUNCTION
+//Solve with the factored envelope, x holds the right hand side on entry
+static void solveEnvelope(GGASolver *s, double *x)
+{
+	int i, k;
+	
+	for (i = 0; i < s->nodes; i++)
+	{
+		for (k = s->first[i]; k < i; k++)
+		{
+			x[i] -= ENVELOPE(s, i, k) * x[k];
+		}
+		x[i] /= ENVELOPE(s, i, i);
+	}
+	for (i = s->nodes - 1; i >= 0; i--)
+	{
+		x[i] /= ENVELOPE(s, i, i);
+		for (k = s->first[i]; k < i; k++)
+		{
+			x[k] -= ENVELOPE(s, i, k) * x[i];
+		}
+	}
+}
+
+//FUNCTION
+//Head loss and its gradient for link k at flow q. Pumps follow a single 
+//	point curve through their base case operating point
+static double linkHeadloss(GGASolver *s, int k, double q, double *gradient)
+{
+	double h, g;
+	
+	if (s->type[k] == EN_PUMP)
+	{
+		g = 2.0 * s->resistance[k] * fabs(q);
+		h = s->resistance[k] * fabs(q) * q - s->shutoff[k];
+	}
+	else
+	{
+		g = s->headExponent * s->resistance[k] * 
+			pow(fabs(q), s->headExponent - 1.0) + 2.0 * s->minorLoss[k] * fabs(q);
+		h = s->resistance[k] * pow(fabs(q), s->headExponent - 1.0) * q + 
+			s->minorLoss[k] * fabs(q) * q;
+	}
+	
+	//Linear below the smallest gradient, as EPANET does
+	if (g < MIN_GRADIENT)
+	{
+		g = MIN_GRADIENT;
+		if (s->type[k] != EN_PUMP)
+			h = g * q;
+	}
+	
+	*gradient = g;
+	return h;
+}
+
+//FUNCTION
+//Newton iterations from the current state until the relative flow change 
+//	drops below the accuracy. Returns 0 on convergence
+static int ggaSolve(GGASolver *s)
+{
+	int i, k, a, b, trial;
+	double h, g, p, y, dq, change, total;
+	
+	for (trial = 0; trial < GGA_MAX_TRIALS; trial++)
+	{
+		s->iterations++;
+		
+		for (i = 0; i < s->diagonal[s->nodes - 1] + 1; i++)
+		{
+			s->envelope[i] = 0.0;
+		}
+		for (i = 0; i < s->nodes; i++)
+		{
+			s->rhs[s->position[i]] = -s->demand[i];
+		}
+		
+		for (k = 0; k < s->links; k++)
+		{
+			if (s->type[k] < 0)
+				continue;
+			
+			h = linkHeadloss(s, k, s->flow[k], &g);
+			p = 1.0 / g;
+			y = p * h;
+			s->gradient[k] = p;
+			s->correction[k] = y;
+			
+			a = s->from[k];
+			b = s->to[k];
+			if (a < s->nodes)
+			{
+				ENVELOPE(s, s->position[a], s->position[a]) += p;
+				s->rhs[s->position[a]] -= s->flow[k] - y;
+				if (b >= s->nodes)
+					s->rhs[s->position[a]] += p * s->head[b];
+			}
+			if (b < s->nodes)
+			{
+				ENVELOPE(s, s->position[b], s->position[b]) += p;
+				s->rhs[s->position[b]] += s->flow[k] - y;
+				if (a >= s->nodes)
+					s->rhs[s->position[b]] += p * s->head[a];
+			}
+			if (a < s->nodes && b < s->nodes)
+			{
+				if (s->position[a] > s->position[b])
+					ENVELOPE(s, s->position[a], s->position[b]) -= p;
+				else
+					ENVELOPE(s, s->position[b], s->position[a]) -= p;
+			}
+		}
+		
+		//Emitters discharge to the atmosphere, q = C p^gamma
+		for (i = 0; i < s->nodes; i++)
+		{
+			if (s->emitter[i] <= 0.0)
+				continue;
+			
+			h = pow(fabs(s->emitterFlow[i]) / s->emitter[i], 
+				1.0 / s->emitterExponent) / s->pressureRatio;
+			g = (fabs(s->emitterFlow[i]) > 0.0) ? 
+				h / (s->emitterExponent * fabs(s->emitterFlow[i])) : 0.0;
+			if (g < MIN_GRADIENT)
+				g = MIN_GRADIENT;
+			if (s->emitterFlow[i] < 0.0)
+				h = -h;
+			p = 1.0 / g;
+			y = p * h;
+			s->emitterGradient[i] = p;
+			s->emitterCorrection[i] = y;
+			
+			ENVELOPE(s, s->position[i], s->position[i]) += p;
+			s->rhs[s->position[i]] -= s->emitterFlow[i] - y;
+			s->rhs[s->position[i]] += p * s->elevation[i];
+		}
+		
+		if (factorEnvelope(s) != 0)
+			return 1;
+		solveEnvelope(s, s->rhs);
+		
+		for (i = 0; i < s->nodes; i++)
+		{
+			s->head[i] = s->rhs[s->position[i]];
+		}
+		
+		change = total = 0.0;
+		for (k = 0; k < s->links; k++)
+		{
+			if (s->type[k] < 0)
+				continue;
+			
+			dq = s->correction[k] - s->gradient[k] * 
+				(s->head[s->from[k]] - s->head[s->to[k]]);
+			s->flow[k] -= dq;
+			change += fabs(dq);
+			total += fabs(s->flow[k]);
+		}
+		for (i = 0; i < s->nodes; i++)
+		{
+			if (s->emitter[i] <= 0.0)
+				continue;
+			
+			dq = s->emitterCorrection[i] - s->emitterGradient[i] * 
+				(s->head[i] - s->elevation[i]);
+			s->emitterFlow[i] -= dq;
+			change += fabs(dq);
+			total += fabs(s->emitterFlow[i]);
+		}
+		
+		if (total > 0.0 && change / total < s->accuracy)
+			return 0;
+	}
+	
+	return 1;
+}
+
+//FUNCTION
+//Read the network and the base case solution from the toolkit, order the 
+//	junctions and lay out the envelope. The solver is then run from a cold 
+//	start and must reproduce the EPANET base case pressures to within 
+//	tolerance. Returns non-zero, with nothing left allocated, if formula, 
+//	the network's headlossFormula, is not Hazen-Williams, the network has 
+//	links the solver does not model or the check fails. The solver must be 
+//	zeroed or previously opened, anything it still holds is released
+int openGGASolver(GGASolver *s, int numNodes, double tolerance, int formula)
+{
+	int i, k, a, b, type, units, totalNodes;
+	float value, diameter, length, roughness, minorLoss, head;
+	double qcf, lcf, dcf, d, worst;
+	
+	closeGGASolver(s);
+	
+	ENgetcount(EN_NODECOUNT, &totalNodes);
+	ENgetcount(EN_LINKCOUNT, &s->links);
+	ENgetflowunits(&units);
+	
+	s->nodes = numNodes;
+	s->totalNodes = totalNodes;
+	s->headExponent = headlossExponent(formula);
+	ENgetoption(EN_EMITEXPON, &value);
+	s->emitterExponent = value;
+	ENgetoption(EN_ACCURACY, &value);
+	s->accuracy = value * 0.1;
+	
+	//Only the Hazen-Williams resistance is modelled
+	if (formula != HEADLOSS_HW)
+		return 1;
+	
+	s->from = (int *) calloc(s->links, sizeof(int));
+	s->to = (int *) calloc(s->links, sizeof(int));
+	s->type = (int *) calloc(s->links, sizeof(int));
+	s->resistance = (double *) calloc(s->links, sizeof(double));
+	s->minorLoss = (double *) calloc(s->links, sizeof(double));
+	s->shutoff = (double *) calloc(s->links, sizeof(double));
+	s->flow = (double *) calloc(s->links, sizeof(double));
+	s->baseFlow = (double *) calloc(s->links, sizeof(double));
+	s->gradient = (double *) calloc(s->links, sizeof(double));
+	s->correction = (double *) calloc(s->links, sizeof(double));
+	s->elevation = (double *) calloc(totalNodes, sizeof(double));
+	s->head = (double *) calloc(totalNodes, sizeof(double));
+	s->baseHead = (double *) calloc(totalNodes, sizeof(double));
+	s->demand = (double *) calloc(numNodes, sizeof(double));
+	s->emitter = (double *) calloc(numNodes, sizeof(double));
+	s->emitterFlow = (double *) calloc(numNodes, sizeof(double));
+	s->baseEmitterFlow = (double *) calloc(numNodes, sizeof(double));
+	s->emitterGradient = (double *) calloc(numNodes, sizeof(double));
+	s->emitterCorrection = (double *) calloc(numNodes, sizeof(double));
+	s->rhs = (double *) calloc(numNodes, sizeof(double));
+	s->order = (int *) calloc(numNodes, sizeof(int));
+	s->position = (int *) calloc(numNodes, sizeof(int));
+	s->first = (int *) calloc(numNodes, sizeof(int));
+	s->diagonal = (long *) calloc(numNodes, sizeof(long));
+	
+	//Unit conversions to the internal ft and cfs of the head loss formulas
+	qcf = flowPerCFS[units];
+	lcf = (units <= EN_AFD) ? 1.0 : 0.3048;
+	dcf = (units <= EN_AFD) ? 12.0 : 304.8;
+	s->pressureRatio = 0.0;
+	
+	for (i = 1; i <= totalNodes; i++)
+	{
+		ENgetnodevalue(i, EN_ELEVATION, &value);
+		s->elevation[i-1] = value;
+		ENgetnodevalue(i, EN_HEAD, &head);
+		s->head[i-1] = head;
+		if (i <= numNodes)
+		{
+			ENgetnodevalue(i, EN_DEMAND, &value);
+			s->demand[i-1] = value;
+			ENgetnodevalue(i, EN_EMITTER, &value);
+			s->emitter[i-1] = value;
+			ENgetnodevalue(i, EN_PRESSURE, &value);
+			if (s->pressureRatio == 0.0 && fabs(head - s->elevation[i-1]) > 1.0e-3)
+				s->pressureRatio = value / (head - s->elevation[i-1]);
+		}
+	}
+	if (s->pressureRatio == 0.0)
+		s->pressureRatio = (units <= EN_AFD) ? PSI_PER_FOOT : 1.0;
+	
+	for (k = 0; k < s->links; k++)
+	{
+		ENgetlinktype(k + 1, &type);
+		ENgetlinknodes(k + 1, &a, &b);
+		s->from[k] = a - 1;
+		s->to[k] = b - 1;
+		s->type[k] = type;
+		
+		ENgetlinkvalue(k + 1, EN_FLOW, &value);
+		s->baseFlow[k] = value;
+		ENgetlinkvalue(k + 1, EN_STATUS, &value);
+		if (value == 0.0)
+		{
+			//Closed links are left out of the equations
+			s->type[k] = -1;
+			s->baseFlow[k] = 0.0;
+			continue;
+		}
+		
+		if (type > EN_PUMP)
+		{
+			closeGGASolver(s);
+			return 1;
+		}
+		
+		if (type == EN_PUMP)
+		{
+			//Single point curve through the operating point, shutoff head 
+			//	4/3 of the operating head
+			head = s->head[b-1] - s->head[a-1];
+			if (fabs(s->baseFlow[k]) <= 0.0 || head <= 0.0)
+			{
+				s->type[k] = -1;
+				s->baseFlow[k] = 0.0;
+				continue;
+			}
+			s->shutoff[k] = (4.0 / 3.0) * head;
+			s->resistance[k] = head / (3.0 * s->baseFlow[k] * s->baseFlow[k]);
+			continue;
+		}
+		
+		ENgetlinkvalue(k + 1, EN_DIAMETER, &diameter);
+		ENgetlinkvalue(k + 1, EN_LENGTH, &length);
+		ENgetlinkvalue(k + 1, EN_ROUGHNESS, &roughness);
+		ENgetlinkvalue(k + 1, EN_MINORLOSS, &minorLoss);
+		
+		d = diameter / dcf;
+		s->resistance[k] = lcf * 4.727 * pow(roughness, -1.852) * 
+			pow(d, -4.871) * (length / lcf) / pow(qcf, 1.852);
+		s->minorLoss[k] = lcf * 0.02517 * minorLoss / pow(d, 4.0) / 
+			(qcf * qcf);
+	}
+	
+	for (i = 0; i < totalNodes; i++)
+	{
+		s->baseHead[i] = s->head[i];
+	}
+	
+	orderJunctions(s);
+	layoutEnvelope(s);
+	
+	//Cold start at 1 ft/s in every pipe and 1 cfs out of every emitter
+	for (i = 0; i < numNodes; i++)
+	{
+		if (s->emitter[i] > 0.0)
+			s->emitterFlow[i] = qcf;
+	}
+	for (k = 0; k < s->links; k++)
+	{
+		s->flow[k] = s->baseFlow[k];
+		if (s->type[k] >= 0 && s->type[k] != EN_PUMP)
+		{
+			ENgetlinkvalue(k + 1, EN_DIAMETER, &diameter);
+			d = diameter / dcf;
+			s->flow[k] = 0.785398 * d * d * qcf;
+		}
+	}
+	
+	worst = 0.0;
+	if (ggaSolve(s) != 0)
+		worst = tolerance + 1.0;
+	for (i = 0; i < numNodes && worst <= tolerance; i++)
+	{
+		ENgetnodevalue(i + 1, EN_PRESSURE, &value);
+		d = fabs(s->pressureRatio * (s->head[i] - s->elevation[i]) - value);
+		if (d > worst)
+			worst = d;
+	}
+	if (worst > tolerance)
+	{
+		closeGGASolver(s);
+		return 1;
+	}
+	
+	//Perturbed solves start from the converged base case
+	for (i = 0; i < totalNodes; i++)
+	{
+		s->baseHead[i] = s->head[i];
+	}
+	for (k = 0; k < s->links; k++)
+	{
+		s->baseFlow[k] = s->flow[k];
+	}
+	for (i = 0; i < numNodes; i++)
+	{
+		s->baseEmitterFlow[i] = s->emitterFlow[i];
+	}
+	
+	return 0;
+}
+
+//FUNCTION
+//Junction pressures with an emitter of the given coefficient added at node 
+//	(zero based), warm started from the base case. Values go through float 
+//	like the toolkit's. Returns non-zero if the solve did not converge
+int ggaOneLeak(GGASolver *s, int node, double emitterCoeff, double *pressures)
+{
+	int i, k, error;
+	double baseEmitter, pressure;
+	
+	for (i = 0; i < s->totalNodes; i++)
+	{
+		s->head[i] = s->baseHead[i];
+	}
+	for (k = 0; k < s->links; k++)
+	{
+		s->flow[k] = s->baseFlow[k];
+	}
+	for (i = 0; i < s->nodes; i++)
+	{
+		s->emitterFlow[i] = s->baseEmitterFlow[i];
+	}
+	
+	//The leak starts out discharging at the base case pressure
+	baseEmitter = s->emitter[node];
+	s->emitter[node] += emitterCoeff;
+	pressure = s->pressureRatio * (s->baseHead[node] - s->elevation[node]);
+	if (pressure > 0.0)
+		s->emitterFlow[node] += emitterCoeff * pow(pressure, s->emitterExponent);
+	error = ggaSolve(s);
+	s->emitter[node] = baseEmitter;
+	
+	if (error)
+		return error;
+	
+	for (i = 0; i < s->nodes; i++)
+	{
+		pressures[i] = (float)(s->pressureRatio * (s->head[i] - s->elevation[i]));
+	}
+	return 0;
+}
+
+//FUNCTION
+//Release everything openGGASolver allocated
+void closeGGASolver(GGASolver *s)
+{
+	free(s->from);
+	free(s->to);
+	free(s->type);
+	free(s->resistance);
+	free(s->minorLoss);
+	free(s->shutoff);
+	free(s->flow);
+	free(s->baseFlow);
+	free(s->gradient);
+	free(s->correction);
+	free(s->elevation);
+	free(s->head);
+	free(s->baseHead);
+	free(s->demand);
+	free(s->emitter);
+	free(s->emitterFlow);
+	free(s->baseEmitterFlow);
+	free(s->emitterGradient);
+	free(s->emitterCorrection);
+	free(s->rhs);
+	free(s->order);
+	free(s->position);
+	free(s->first);
+	free(s->diagonal);
+	free(s->envelope);
+	memset(s, 0, sizeof(GGASolver));
+}
+
+//FUNCTION
+//Keep the link flows of the solve in progress as the base case flows. Called
+//	at the first time step of the base case, which is the instant every 
+//	later solve starts at
+void saveBaseFlows(HydraulicSession *s)
+{
+	float flow;
+	int i;
+
+	ENgetcount(EN_LINKCOUNT, &s->links);
+	s->baseFlows = (double *) realloc(s->baseFlows, 
+		s->links * sizeof(double));
+	for (i = 0; i < s->links; i++)
+	{
+		ENgetlinkvalue(i + 1, EN_FLOW, &flow);
+		s->baseFlows[i] = flow;
+	}
+}
+
+//FUNCTION
+//Start a solve, opening the hydraulic solver if the session does not hold
+//	it open already. ENinitH(0) keeps the link flows the solver holds, 
+//	which are the toolkit's defaults after ENopenH and the base case flows
+//	once they are set. A solver held open without them is reinitialized 
+//	(ENinitH(1)), so no solve depends on the one before
+void beginSolve(HydraulicSession *s)
+{
+	int fresh;
+
+	fresh = !s->open;
+	if (!s->open)
+	{
+		ENopenH();
+		s->open = 1;
+	}
+	
+	s->warm = 0;
+#ifdef EPANET_INITFLOW
+	if (s->baseFlows)
+	{
+		int i;
+
+		for (i = 0; i < s->links; i++)
+		{
+			ENsetlinkvalue(i + 1, EN_INITFLOW, (float) s->baseFlows[i]);
+		}
+		s->warm = 1;
+	}
+#endif
+	ENinitH((fresh || s->warm) ? 0 : 1);
+}
+
+//FUNCTION
+//beginSolve for the solver of a worker's project, opened by the caller. 
+//	fresh says it was opened for this solve. The base case flows are read
+//	only, so every worker can share the session's
+#ifdef EPANET_2_2
+void initProjectSolve(HydraulicSession *s, EN_Project ph, int fresh)
+{
+	int warm;
+
+	warm = 0;
+#ifdef EPANET_INITFLOW
+	if (s->baseFlows)
+	{
+		int i;
+
+		for (i = 0; i < s->links; i++)
+		{
+			EN_setlinkvalue(ph, i + 1, EN_INITFLOW, s->baseFlows[i]);
+		}
+		warm = 1;
+	}
+#endif
+	EN_initH(ph, (fresh || warm) ? 0 : 1);
+}
+#endif
+
+//FUNCTION
+//Finish a solve, counting its Newton trials (EPANET 2.2 only, and only the 
+//	trials of the final time step, the toolkit keeps no total). Outside a 
+//	persistent session the solver is closed
+void endSolve(HydraulicSession *s)
+{
+#ifdef EPANET_2_2
+	float trials;
+
+	if (ENgetstatistic(EN_ITERATIONS, &trials) == 0)
+	{
+		if (s->warm)
+			s->warmTrials += trials;
+		else
+			s->coldTrials += trials;
+	}
+#endif
+	if (s->warm)
+		s->warmSolves++;
+	s->solves++;
+
+	if (!s->persistent)
+	{
+		ENcloseH();
+		s->open = 0;
+	}
+}
+
+//FUNCTION
+//Close the solver and report an estimate of the trials the base case flow
+//	starts saved. It compares the final time step trials of the warm and 
+//	cold solves on average, the earlier time steps are not counted
+void closeSession(HydraulicSession *s)
+{
+	long coldSolves;
+
+	if (s->open)
+		ENcloseH();
+	s->open = 0;
+
+	coldSolves = s->solves - s->warmSolves;
+	if (s->warmSolves > 0 && coldSolves > 0 && s->coldTrials > 0.0)
+	{
+		printf("\nHydraulic session: %ld solves, about %.0f Newton trials "
+			"saved by base case flow starts (estimate, final time steps "
+			"only)\n", s->solves, 
+			s->coldTrials / coldSolves * s->warmSolves - s->warmTrials);
+	}
+	
+	free(s->baseFlows);
+	s->baseFlows = NULL;
+}
+
+//FUNCTION
+//Allocate the result vectors for the first numNodes nodes. The double vector
+//	covers every node, so that EN_getnodevalues can fill it directly
+int openNodeResults(NodeResults *r, int numNodes)
+{
+	ENgetcount(EN_NODECOUNT, &r->allNodes);
+	if (r->allNodes < numNodes)
+		r->allNodes = numNodes;
+	r->nodes = numNodes;
+	r->single = (float *) calloc(r->allNodes, sizeof(float));
+	r->values = (double *) calloc(r->allNodes, sizeof(double));
+	
+	if (!r->single || !r->values)
+	{
+		closeNodeResults(r);
+		return 1;
+	}
+	
+	return 0;
+}
+
+//FUNCTION
+//Read one property of the last solve for every node into r->values and 
+//	return it. EPANET 2.2 returns the whole vector in one call, the 2.0 
+//	toolkit is read one node at a time. Either way the single precision 
+//	values are widened in one plain loop over restrict pointers. gcc only 
+//	vectorizes it at -O3, as -O2 skips loops of unknown length, so the run 
+//	scripts build with -O3
+double *readNodeResults(NodeResults *r, int property)
+{
+	int i, count;
+	const float *restrict single;
+	double *restrict values;
+	
+#ifdef EPANET_2_2
+	count = r->allNodes;
+	ENgetnodevalues(property, r->single);
+#else
+	count = r->nodes;
+	for (i = 0; i < count; i++)
+	{
+		ENgetnodevalue(i + 1, property, &r->single[i]);
+	}
+#endif
+	
+	single = r->single;
+	values = r->values;
+	for (i = 0; i < count; i++)
+	{
+		values[i] = single[i];
+	}
+	
+	return r->values;
+}
+
+//FUNCTION
+//Release what openNodeResults allocated
+void closeNodeResults(NodeResults *r)
+{
+	free(r->single);
+	free(r->values);
+	r->single = NULL;
+	r->values = NULL;
+	r->nodes = r->allNodes = 0;
+}
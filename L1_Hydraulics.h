@@ -0,0 +1,99 @@
+#ifndef L1_HYDRAULICS_H
+#define L1_HYDRAULICS_H
+
+#include "L1_Matrix.h"
+#ifdef EPANET_2_2
+#include "epanet2_2.h"
+#endif
+
+//Head loss formulas, numbered as EPANET 2.2's EN_HW, EN_DW and EN_CM
+#define HEADLOSS_HW 0
+#define HEADLOSS_DW 1
+#define HEADLOSS_CM 2
+
+//Network linearized about the hydraulic state the toolkit currently holds.
+//	The junction heads respond to a small extra outflow through the
+//	conductance matrix of the links, which is factored once so that the
+//	pressure response to a leak at any junction is two triangular solves
+
+typedef struct
+{
+	int nodes;
+	double pressureRatio; //Pressure units per unit of head
+	double emitterExponent;
+	double *pressure; //Junction pressures at the linearization point
+	double *work;
+	DenseMatrix factor; //Lower Cholesky factor of the conductance matrix
+} NetworkLinearization;
+
+//Steady state Global Gradient solver for the leak sweep. The network is 
+//	read once from the toolkit, the junctions are put in reverse 
+//	Cuthill-McKee order and the envelope of the head equations is laid out 
+//	once, so every perturbed solve only refills and refactors the envelope
+
+typedef struct
+{
+	int nodes; //Junctions, the unknown heads
+	int totalNodes, links;
+	int *from, *to, *type; //Nodes from 0, fixed heads after the junctions
+	double *resistance, *minorLoss, *shutoff;
+	double *elevation, *demand, *emitter;
+	double headExponent, emitterExponent, pressureRatio, accuracy;
+	int *order, *position, *first;
+	long *diagonal;
+	double *envelope;
+	double *head, *flow, *emitterFlow, *baseHead, *baseFlow, *baseEmitterFlow;
+	double *rhs, *gradient, *correction, *emitterGradient, *emitterCorrection;
+	long iterations;
+} GGASolver;
+
+//Hydraulic solver kept open for the whole run. The base case, single leak 
+//	and observation solves differ by a few emitters, so with a toolkit that
+//	can set link flows (-DEPANET_INITFLOW, ENsetlinkvalue taking 
+//	EN_INITFLOW) each solve starts from the flows of the base case. The 
+//	stock 2.0 and 2.2 toolkits cannot, every solve is then reinitialized 
+//	and only the reopening of the solver is saved
+
+typedef struct
+{
+	int persistent; //0 opens and closes the solver around every solve
+	int open;
+	int warm; //The current solve started from baseFlows
+	int links;
+	double *baseFlows; //Link flows at the first time step of the base case
+	long solves;
+	double coldTrials; //Newton trials of cold started solves
+	double warmTrials; //Newton trials of solves started from baseFlows
+	long warmSolves;
+} HydraulicSession;
+
+//Node results of the last solve, read a whole vector per call instead of 
+//	one toolkit call per node and property
+
+typedef struct
+{
+	int nodes; //Nodes read, the junctions
+	int allNodes; //Length of the vectors, every node in the network
+	float *single; //Values at the toolkit's precision
+	double *values; //values[i-1] holds node i
+} NodeResults;
+
+int headlossFormula(const char *);
+int linearizeNetwork(NetworkLinearization *, int, int);
+void linearizedPressures(NetworkLinearization *, int, double, double *);
+void freeLinearization(NetworkLinearization *);
+int openGGASolver(GGASolver *, int, double, int);
+int ggaOneLeak(GGASolver *, int, double, double *);
+void closeGGASolver(GGASolver *);
+void saveBaseFlows(HydraulicSession *);
+void beginSolve(HydraulicSession *);
+#ifdef EPANET_2_2
+void initProjectSolve(HydraulicSession *, EN_Project, int);
+#endif
+void endSolve(HydraulicSession *);
+void closeSession(HydraulicSession *);
+int openNodeResults(NodeResults *, int);
+double *readNodeResults(NodeResults *, int);
+void closeNodeResults(NodeResults *);
+
+#endif
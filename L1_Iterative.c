@@ -4,8 +4,18 @@
 #include <time.h>
 #include <math.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "L1_Matrix.h"
+#include "L1_Hydraulics.h"
+#include "L1_Solver.h"
 #include "epanet2.h" 
 #include "gurobi_c.h"
+#ifdef EPANET_2_2
+#include <pthread.h>
+#include "epanet2_2.h"
+#endif
 
 //September 10, 2013
 //L1-Approximation (L1 calculates absolute error, in this case, between
@@ -18,41 +28,96 @@
 //
 //
 int numOfLeaks = 2, iterations = 50;
+int solverBackend = SOLVER_GUROBI; //SOLVER_GUROBI or SOLVER_HIGHS, which needs -DHAVE_HIGHS and links by tight M rows without hints
+int mipGuidance = 1; //1 gives the MIP branch priorities, hints and continuous starts from the LP magnitudes
+int modelChunk = 1 << 20; //Non-zeros staged per call when the leak magnitude columns are added
+int boundTightening = 1; //1 bounds the leak magnitudes and residuals from b and A before every solve
+int sensitivityThreads = 1; //Worker threads for the sensitivity sweep (EPANET 2.2)
+int sensitivityProcesses = 1; //Forked workers for the sensitivity sweep
+int sensitivityMode = 0; //0 simulates every leak, 1 solves the linearized network, 2 uses the built-in GGA solver
+double ggaTolerance = 0.1; //Largest base case or check leak pressure difference accepted from the GGA solver
+int ggaChecks = 5; //Leaks solved by both EPANET and the GGA solver before the GGA solver is used
+int hydraulicSession = 0; //1 keeps the hydraulic solver open for the whole run, 0 reopens it per solve
+long analysisTime = -1; //Seconds into the simulation the pressures are read at, -1 for the end of EN_DURATION
+int snapshotMode = 0; //1 solves the instant at analysisTime alone, starting from the initial tank levels
+int reportPeriods = 1; //Report times stacked into the L1 rows, the last one at analysisTime
+long reportInterval = 3600; //Seconds between the stacked report times
+int linkingFormulation = 0; //Links leaks to binaries by 0 bigM rows, 1 SOS1 pairs, 2 tight M rows per node, 3 indicator constraints (Gurobi 7+)
+int sensitivityCacheSlots = 2; //Single leak columns remembered per node
+int secantUpdates = 0; //1 moves the support columns of A by Broyden updates between passes instead of simulating them
+double secantTolerance = 0.05; //Relative L1 misfit of the secant model above which the columns are simulated again
 double delta = 1, minLeakSize = 1.0, maxLeakSize = 10.0,
 	binaryLeakLimit = 2.0, minLeakThreshold = 0.5;
 char inputFile[50] = "Net3.inp";//"hanoi-1.inp"; //
+char baseCaseStore[50] = "Net3.base"; //"hanoi-1.base"; "" disables the store
 char reportFile[50] = "Net3.rpt";//"hanoi.rpt"; //
 char directoryString[50] = "L1_Iterative/";
 
 //
 //
 
-int totalNodeCount, EPANETsimCounter;
-int *leakNodes, *MIPStartSolution;
+int totalNodeCount, totalRowCount, EPANETsimCounter, cacheHits,
+	cacheMisses, secantCounter;
+int *leakNodes, *MIPStartSolution, *sweepColumns, *secantColumns;
+long cacheClock, *cacheStamps, *reportTimes;
+unsigned long long baseKey;
 double totalDemand, averageDelta, averagePreviousDelta, bigM = 9999999999.99,
 	totalTime, timePerIteration;
 double *baseCasePressureMatrix, *observedPressure, *coefficients, *b, *bhat,
 	*realLeakValues, *singleRunErrors, *leakDemands, *leakMagnitudes, 
-	*LPmodelError, *MIPmodelError, *deltas, *previousDeltas, *leakGuesses,
-	**largePressureMatrix, **largeA, **Ahat,  **I, *LPSolutions, *MIPSolutions, *tempSolutions,
-	*LPobjectiveValues, *MIPobjectiveValues; 
+	*LPmodelError, *MIPmodelError, *deltas, *previousDeltas, *modelDeltas,
+	*leakGuesses,
+	*LPSolutions, *MIPSolutions, *tempSolutions,
+	*LPobjectiveValues, *MIPobjectiveValues, *cachedCoefficients, 
+	*secantResponse, *secantMisfit, *MIPStartMagnitudes, **cachedColumns; 
 char globalDirName[100];
 clock_t startTime, endTime, iterationStartTime, iterationEndTime;
 
 
+DenseMatrix largePressureMatrix, largeA;
+NetworkLinearization linearization;
+GGASolver ggaSolver;
+HydraulicSession session;
+NodeResults nodeResults;
 FILE *ptr_file;
 
 
 void initializeArrays();
 void populateMatricies(int);
+int addL1Model(SolverModel *, int, int);
+int addLeakColumns(SolverModel *, int, int);
 void populateBMatrix(int);
 void randomizeLeaks(int, int);
 void printLeakInfo(int);
+void setAnalysisTime();
+int reportPeriod(long);
 void analyzeBaseCase(int);
+int checkGGASolver(int);
+unsigned long long hashBytes(unsigned long long, const void *, size_t);
+unsigned long long baseCaseKey(int);
+int loadBaseCase(int);
+int saveBaseCase(int);
 void oneLeak(int, double, int, int);
+void sensitivitySweep(int);
+int loadCachedColumn(int, double, int);
+void storeCachedColumn(int, double, int);
+int forkedOneLeaks(int *, int, int);
+#ifdef EPANET_2_2
+int threadedOneLeaks(int *, int, int);
+void projectOneLeak(EN_Project, int, double, int, int, double *);
+#endif
 void nLeaks(int, int);
+int leakBounds(int, double *);
+int tightenBounds(SolverModel *, int);
+void linkBounds(int, double *);
+int updateLinkBounds(SolverModel *, int);
+int addLinkConstraints(SolverModel *, int);
+void supportLeaks(int, double *, double *);
+int secantUpdate(int, double *);
+int updateModelColumns(SolverModel *, int);
 void findHighestMagnitudes(double *);
 void forgeMIPStartSolution(double []);
+int guideMIP(SolverModel *, int);
 double calculateError(int, double[]);
 int writeSummaryFile(int, int, double, double[]);
 int writeRawResults(int, int, double[]);
@@ -64,43 +129,56 @@ int setOutputDirectory();
 int main(int argc, char *argv[]) 
 {
 	startTime = clock();
-	GRBenv *env = NULL;
-	GRBmodel *model = NULL;
-	int  i, j, k, l, numNodes, storage, counter, directoryCode;
+	SolverModel solver;
+	int  i, j, k, l, numNodes, storage, counter, directoryCode, basisSaved,
+		improved;
 	double previousObjectiveValue;
 	
 	//Randomize the leak locations, commented out will use the same seeding 
 	//for each run
 	//srand(time(NULL));
 	
-	i = j = k = l = numNodes = counter = EPANETsimCounter = 0;
+	i = j = k = l = numNodes = counter = EPANETsimCounter = basisSaved = 0;
+	improved = 0;
+	cacheHits = cacheMisses = secantCounter = 0;
+	cacheClock = 0;
 	averageDelta = averagePreviousDelta = previousObjectiveValue = 0.0;
 	
 	//Open EPANET & Input file
 	ENopen(inputFile,reportFile,"");
 	
+	setAnalysisTime();
+	session.persistent = hydraulicSession;
+	
 	// Get the number of nodes
 	ENgetcount(EN_NODECOUNT, &numNodes);
 	ENgetcount(EN_TANKCOUNT, &storage);
 	totalNodeCount = numNodes - storage;
+	totalRowCount = totalNodeCount * reportPeriods;
+	openNodeResults(&nodeResults, totalNodeCount);
+	
+	baseKey = baseCaseKey(totalNodeCount);
 	
 	int       error = 0;
-	double    sol[(totalNodeCount * 3)];
-	int       ind[(totalNodeCount * 3)];
-	double    val[(totalNodeCount * 3)];
-	double    obj[(totalNodeCount * 3)];
-	char      vtype[(totalNodeCount * 3)];	
+	double    sol[((totalNodeCount * 2) + totalRowCount)];
+	int       VBasis[(totalNodeCount + totalRowCount)];
+	int       CBasis[(totalRowCount * 2)];
 	int       optimstatus;
-	double    objval;
+	double    objval, binaryStart[totalNodeCount];
 	
 	leakNodes = (int *) calloc(numOfLeaks, sizeof(int));
 	MIPStartSolution = (int *) calloc(totalNodeCount, sizeof(int));
-	
-	baseCasePressureMatrix = (double *) calloc(totalNodeCount, sizeof(double));
-	observedPressure = (double *) calloc(totalNodeCount, sizeof(double));
-	coefficients = (double *) calloc((totalNodeCount * 2), sizeof(double));
-	b = (double *) calloc(totalNodeCount, sizeof(double));
-	bhat = (double *) calloc((totalNodeCount * 2), sizeof(double));
+	sweepColumns = (int *) calloc(totalNodeCount, sizeof(int));
+	secantColumns = (int *) calloc(totalNodeCount, sizeof(int));
+	
+	baseCasePressureMatrix = (double *) calloc(totalRowCount, sizeof(double));
+	observedPressure = (double *) calloc(totalRowCount, sizeof(double));
+	coefficients = (double *) calloc((totalNodeCount + totalRowCount), 
+		sizeof(double));
+	b = (double *) calloc(totalRowCount, sizeof(double));
+	bhat = (double *) calloc((totalRowCount * 2), sizeof(double));
+	secantResponse = (double *) calloc(totalRowCount, sizeof(double));
+	secantMisfit = (double *) calloc(totalRowCount, sizeof(double));
 	realLeakValues = (double *) calloc(totalNodeCount, sizeof(double));
 	singleRunErrors = (double *) calloc(totalNodeCount, sizeof(double));
 	leakDemands = (double *) calloc(numOfLeaks, sizeof(double));
@@ -110,50 +188,60 @@ int main(int argc, char *argv[])
 	LPobjectiveValues = (double *) calloc(iterations, sizeof(double));
 	MIPobjectiveValues = (double *) calloc(iterations, sizeof(double));
 	
-	LPSolutions = (double *) calloc(totalNodeCount * 2, sizeof(double));
-	MIPSolutions = (double *) calloc(totalNodeCount * 2, sizeof(double));
-	tempSolutions = (double *) calloc(totalNodeCount * 2, sizeof(double));
+	LPSolutions = (double *) calloc(totalNodeCount + totalRowCount, 
+		sizeof(double));
+	MIPSolutions = (double *) calloc(totalNodeCount + totalRowCount, 
+		sizeof(double));
+	tempSolutions = (double *) calloc(totalNodeCount + totalRowCount, 
+		sizeof(double));
 	
 	deltas = (double *) calloc(totalNodeCount, sizeof(double));
 	previousDeltas = (double *) calloc(totalNodeCount, sizeof(double));
+	modelDeltas = (double *) calloc(totalNodeCount, sizeof(double));
 	leakGuesses = (double *) calloc(binaryLeakLimit, sizeof(double));
+	MIPStartMagnitudes = (double *) calloc(totalNodeCount, sizeof(double));
+	
+	//Single leak column cache, columns are allocated as they are stored. The
+	//	network is never changed between simulations so entries stay valid 
+	//	for the whole run
+	if (sensitivityCacheSlots < 0)
+		sensitivityCacheSlots = 0;
+	cachedCoefficients = (double *) calloc(totalNodeCount * sensitivityCacheSlots,
+		sizeof(double));
+	cacheStamps = (long *) calloc(totalNodeCount * sensitivityCacheSlots, 
+		sizeof(long));
+	cachedColumns = (double **) calloc(totalNodeCount * sensitivityCacheSlots, 
+		sizeof(double *));
+	
+	//The pressure matrix is a shared mapping when forked workers fill it
+	if (sensitivityProcesses < 2 || createMatrix(&largePressureMatrix, 
+		totalRowCount, totalNodeCount, 1) != 0)
+		createMatrix(&largePressureMatrix, totalRowCount, totalNodeCount, 0);
+	createMatrix(&largeA, totalRowCount, totalNodeCount, 0);
 	
-	largePressureMatrix = (double **) calloc(totalNodeCount, sizeof(double *));
-	for(i = 0; i < totalNodeCount; i++)
-	{
-		largePressureMatrix[i] = (double *) calloc(totalNodeCount, sizeof(double));
-	}
-	
-	largeA = (double **) calloc(totalNodeCount, sizeof(double *));
-	for(i = 0; i < totalNodeCount; i++)
-	{
-		largeA[i] = (double *) calloc(totalNodeCount, sizeof(double));
-	}
-	
-	I = (double **) calloc(totalNodeCount, sizeof(double *));
-	for(i = 0; i < totalNodeCount; i++)
-	{
-		I[i] = (double *) calloc(totalNodeCount, sizeof(double));
-	}
-	
-	Ahat = (double **) calloc( (totalNodeCount * 2), sizeof(double *) );
-	for(i = 0; i < (totalNodeCount * 2); i++)
-	{
-		Ahat[i] = (double *) calloc( (totalNodeCount * 2), sizeof(double) );
-	}
 		 
 	// Create environment 
- 	error = GRBloadenv(&env, "L1_Iterative.log");
+ 	error = openSolver(&solver, solverBackend, "L1_Iterative.log", 
+		"L1Approx");
  	if (error) goto QUIT;
  	
  	directoryCode = setOutputDirectory();
  	
+	//The unperturbed network is the same in every scenario, so the base case
+	//	is solved, or loaded from the store, just once. The linearized and 
+	//	built-in solvers need the toolkit to hold the solved base case
+	if (sensitivityMode != 0 || loadBaseCase(totalNodeCount) != 0)
+	{
+		analyzeBaseCase(totalNodeCount);
+		saveBaseCase(totalNodeCount);
+	}
+	
 	//Create observation	
 	for (k = 0; k < iterations; k++)
 	{
 		iterationStartTime = clock();
 		
-		EPANETsimCounter = 0;
+		EPANETsimCounter = cacheHits = cacheMisses = secantCounter = 0;
 		
 		initializeArrays();
 		
@@ -161,8 +249,6 @@ int main(int argc, char *argv[])
 							
 		objval = 9999;
 		counter = 0;
- 		
-		analyzeBaseCase(totalNodeCount);
 		
 		nLeaks(numOfLeaks, totalNodeCount);
 		
@@ -173,93 +259,83 @@ int main(int argc, char *argv[])
 
 			counter++;
 
-			populateMatricies(totalNodeCount);		
+			//Later passes try a secant update of the support columns first
+			if (secantUpdates == 0 || counter == 1 || 
+				secantUpdate(totalNodeCount, sol) != 0)
+				populateMatricies(totalNodeCount);
 		
-			// Create an empty model 		
- 			error = GRBnewmodel(env, &model, "L1Approx", 0, NULL, NULL, NULL, NULL, 
- 				NULL);
- 			if (error) goto QUIT;
- 			 	
- 			// Add variables 
- 			for (i = 0; i < (totalNodeCount * 2); i++)
- 			{
- 				obj[i] = coefficients[i]; 			
- 				vtype[i] = GRB_CONTINUOUS; 			
- 			}
- 			 				
-			error = GRBaddvars(model, (totalNodeCount * 2), 0, NULL, NULL, NULL, 
-				obj, NULL, NULL, vtype, NULL);
-			if (error) goto QUIT;
-			
-			// Integrate new variables		
-			error = GRBupdatemodel(model);
-			if (error) goto QUIT;
-			
-			
-			// First constraint: Ax <= b						
-			for (i = 0; i < (totalNodeCount); i++)
-			{		
-				for (j = 0; j < (totalNodeCount); j++)
-				{
-					ind[j] = j;
-					val[j] = Ahat[i][j];			
-				}								
-				ind[totalNodeCount] = j + i;
-				val[totalNodeCount] = Ahat[i][j+i];
-				error = GRBaddconstr(model, (totalNodeCount + 1), ind, val, 
-					GRB_LESS_EQUAL, bhat[i],NULL);			
+			//The LP is built on the first pass of each scenario, later passes 
+			//	only patch the columns whose delta changed and restart from 
+			//	the previous basis and solution
+			if (solver.cols == 0)
+			{
+				error = addL1Model(&solver, totalNodeCount, 0);
 				if (error) goto QUIT;
+				
+				for (i = 0; i < totalNodeCount; i++)
+				{
+					modelDeltas[i] = deltas[i];
+				}
 			}
-			
-			for (i = totalNodeCount; i < (totalNodeCount * 2); i++)
+			else
 			{
+				error = updateModelColumns(&solver, totalNodeCount);
+				if (error) goto QUIT;
+				
+				error = tightenBounds(&solver, totalNodeCount);
+				if (error) goto QUIT;
 				
-					for (j = 0; j < (totalNodeCount); j++)
-					{
-						ind[j] = j;
-						val[j] = Ahat[i][j];			
-					}								
-					ind[totalNodeCount] = j + (i-totalNodeCount);
-					val[totalNodeCount] = Ahat[i][j+(i-totalNodeCount)];
-					error = GRBaddconstr(model, (totalNodeCount + 1), ind, val, 
-						GRB_LESS_EQUAL, bhat[i],NULL);			
+				//Basis statuses and primal starts are Gurobi attributes, 
+				//	HiGHS keeps the basis of the last pass in its model
+				if (basisSaved)
+				{
+					error = GRBsetintattrarray(solver.model, 
+						GRB_INT_ATTR_VBASIS, 0, (totalNodeCount + totalRowCount), 
+						VBasis);
 					if (error) goto QUIT;
-			}
-			
-			/*		
-			// First constraint: Ax <= b						
-			for (i = 0; i < (totalNodeCount * 2); i++)
-			{
-				for (j = 0; j < (totalNodeCount * 2); j++)
+					
+					error = GRBsetintattrarray(solver.model, 
+						GRB_INT_ATTR_CBASIS, 0, (totalRowCount * 2), CBasis);
+					if (error) goto QUIT;
+				}
+				
+				if (solver.backend == SOLVER_GUROBI)
 				{
-					ind[j] = j;
-					val[j] = Ahat[i][j];			
-				}								
-				error = GRBaddconstr(model, (totalNodeCount * 2), ind, val, 
-					GRB_LESS_EQUAL, bhat[i],NULL);			
-				if (error) goto QUIT;
+					error = GRBsetdblattrarray(solver.model, 
+						GRB_DBL_ATTR_PSTART, 0, (totalNodeCount + totalRowCount), 
+						sol);
+					if (error) goto QUIT;
+				}
 			}
-			*/
 			
-			error = GRBoptimize(model);
+			error = solverOptimize(&solver);
 			if (error) goto QUIT;
+			
+			optimstatus = solver.status;
 							
 			previousObjectiveValue = objval;
+			objval = solver.objval;
 			
-			error = GRBgetdblattr(model, GRB_DBL_ATTR_OBJVAL, &objval);
-			if (error) goto QUIT;
-			
-			error = GRBgetdblattrarray(model, GRB_DBL_ATTR_X, 0, 
-					(totalNodeCount * 2), sol);
+			error = solverGetX(&solver, 0, 
+					(totalNodeCount + totalRowCount), sol);
 				if (error) goto QUIT;
 			
+			//Keep the basis for the next pass, if the solve produced one
+			basisSaved = (solver.backend == SOLVER_GUROBI && 
+				GRBgetintattrarray(solver.model, GRB_INT_ATTR_VBASIS, 0, 
+				(totalNodeCount + totalRowCount), VBasis) == 0 && 
+				GRBgetintattrarray(solver.model, GRB_INT_ATTR_CBASIS, 0, 
+				(totalRowCount * 2), CBasis) == 0);
+			
+			//A pass that stopped early, or did no better, ends the loop
+			improved = (optimstatus == GRB_OPTIMAL && 
+				(objval - previousObjectiveValue) < 0);
 				
-				
-			if ((objval - previousObjectiveValue) < 0)
+			if (improved)
 			{								
 				writeInterimResults(k, counter, optimstatus, sol, "LP");
 				
-				for (i = 0; i < totalNodeCount * 2; i++)
+				for (i = 0; i < totalNodeCount + totalRowCount; i++)
 				{
 					LPSolutions[i] = sol[i];
 				}
@@ -279,10 +355,12 @@ int main(int argc, char *argv[])
 				LPobjectiveValues[k] = objval;
 				
 			}
-			
-			// Free model 
-			GRBfreemodel(model);
-		}while((objval - previousObjectiveValue) < 0);
+		}while(improved);
+		
+		// Empty the model for the MIP
+		error = clearSolver(&solver, "L1MIP");
+		if (error) goto QUIT;
+		basisSaved = 0;
 		
 		forgeMIPStartSolution(LPSolutions);
 		objval = 999999;
@@ -292,125 +370,55 @@ int main(int argc, char *argv[])
 		{
 			counter++;
 										
-			populateMatricies(totalNodeCount);		
+			if (secantUpdates == 0 || counter == 1 || 
+				secantUpdate(totalNodeCount, sol) != 0)
+				populateMatricies(totalNodeCount);
 	
-			// Create an empty model 		
- 			error = GRBnewmodel(env, &model, "L1MIP", 0, NULL, NULL, NULL, NULL, 
- 				NULL);
- 			if (error) goto QUIT;
- 			 	
- 			// Add variables 
- 			for (i = 0; i < (totalNodeCount * 2); i++)
- 			{
- 				obj[i] = coefficients[i]; 			
- 				vtype[i] = GRB_CONTINUOUS; 			
- 			}
- 			
- 			for (i = (totalNodeCount * 2); i < (totalNodeCount * 3); i++)
- 			{
- 				obj[i] = 0.0;
- 				vtype[i] = GRB_BINARY;
- 			}
- 			 				
-			error = GRBaddvars(model, (totalNodeCount * 3), 0, NULL, NULL, NULL,
-				obj, NULL, NULL, vtype, NULL);
-			if (error) goto QUIT;
-			
-			// Integrate new variables		
-			error = GRBupdatemodel(model);
-			if (error) goto QUIT;
-			
-			// First constraint: Ax <= b						
-				for (i = 0; i < (totalNodeCount); i++)
-				{
-
-						for (j = 0; j < (totalNodeCount); j++)
-						{
-							ind[j] = j;
-							val[j] = Ahat[i][j];			
-						}								
-						ind[totalNodeCount] = j + i;
-						val[totalNodeCount] = Ahat[i][j+i];
-						error = GRBaddconstr(model, (totalNodeCount + 1), ind, val, 
-							GRB_LESS_EQUAL, bhat[i],NULL);			
-						if (error) goto QUIT;
-
-				}
+			//Same for the MIP, later passes only patch the changed columns
+			if (solver.cols == 0)
+			{
+				error = addL1Model(&solver, totalNodeCount, 1);
+				if (error) goto QUIT;
 				
-				for (i = totalNodeCount; i < (totalNodeCount * 2); i++)
+				for (i = 0; i < totalNodeCount; i++)
 				{
-					
-						for (j = 0; j < (totalNodeCount); j++)
-						{
-							ind[j] = j;
-							val[j] = Ahat[i][j];			
-						}								
-						ind[totalNodeCount] = j + (i-totalNodeCount);
-						val[totalNodeCount] = Ahat[i][j+(i-totalNodeCount)];
-						error = GRBaddconstr(model, (totalNodeCount + 1), ind, val, 
-							GRB_LESS_EQUAL, bhat[i],NULL);			
-						if (error) goto QUIT;					
+					modelDeltas[i] = deltas[i];
 				}
-			
-			
-			
-			/*
-			// First constraint: Ax <= b						
-			for (i = 0; i < (totalNodeCount * 2); i++)
+			}
+			else
 			{
-				for (j = 0; j < (totalNodeCount * 2); j++)
-				{
-					ind[j] = j;
-					val[j] = Ahat[i][j];			
-				}								
-				error = GRBaddconstr(model, (totalNodeCount * 2), ind, val, 
-					GRB_LESS_EQUAL, bhat[i],NULL);			
+				error = updateModelColumns(&solver, totalNodeCount);
 				if (error) goto QUIT;
-			}
-			*/
-			
-			//Leak magnitude - (binary * bigM) <= 0
-			for (i = (totalNodeCount * 2); i < (totalNodeCount * 3); i++)
-			{		
-				ind[0] = (i - (totalNodeCount * 2)); 	ind[1] = i; 
-				val[0] = 1.0; 		val[1] = -bigM ;
-										
-				error = GRBaddconstr(model, 2, ind, val, GRB_LESS_EQUAL,0.0,
-					NULL);
+				
+				error = updateLinkBounds(&solver, totalNodeCount);
+				if (error) goto QUIT;
+				
+				error = tightenBounds(&solver, totalNodeCount);
 				if (error) goto QUIT;
 			}
 			
-			// Limit sum of binaries to number of leaks searching for...		
-			for (i = (totalNodeCount * 2); i < (totalNodeCount * 3); i++)
-			{		
-				ind[i-(totalNodeCount * 2)] = i;
-				val[i-(totalNodeCount * 2)] = 1.0;
-			}								
-			error = GRBaddconstr(model, totalNodeCount, ind, val, 
-				GRB_LESS_EQUAL, binaryLeakLimit,NULL);
-			if (error) goto QUIT;	
-			
 			for(i = 0; i < totalNodeCount; i++)
 			{
-				error = GRBsetdblattrelement(model, "Start", 
-					i + (totalNodeCount * 2), MIPStartSolution[i]);
-				if (error) goto QUIT;
+				binaryStart[i] = MIPStartSolution[i];
 			}
+			error = solverSetStart(&solver, totalNodeCount + totalRowCount, 
+				totalNodeCount, binaryStart);
+			if (error) goto QUIT;
+			
+			error = guideMIP(&solver, totalNodeCount);
+			if (error) goto QUIT;
         	
-			error = GRBoptimize(model);
+			error = solverOptimize(&solver);
 			if (error) goto QUIT;	
 			
 			// Capture solution information		
-			error = GRBgetintattr(model, GRB_INT_ATTR_STATUS, &optimstatus);
-			if (error) goto QUIT;
+			optimstatus = solver.status;
 			
 			previousObjectiveValue = objval;
+			objval = solver.objval;
 			
-			error = GRBgetdblattr(model, GRB_DBL_ATTR_OBJVAL, &objval);
-			if (error) goto QUIT;
-			
-			error = GRBgetdblattrarray(model, GRB_DBL_ATTR_X, 0, 
-				(totalNodeCount * 3), sol);
+			error = solverGetX(&solver, 0, 
+				((totalNodeCount * 2) + totalRowCount), sol);
 			if (error) goto QUIT;
 			
 			for (i = 0; i < totalNodeCount; i++)
@@ -424,10 +432,13 @@ int main(int argc, char *argv[])
 				//printf("\t\tMIP deltas[%d] = %f\n", i, deltas[i]);
 			}
 			
-			if ((objval - previousObjectiveValue) < 0)
+			improved = (optimstatus == GRB_OPTIMAL && 
+				(objval - previousObjectiveValue) < 0);
+			
+			if (improved)
 			{
 				writeInterimResults(k, counter, optimstatus, sol, "MIP");
-				for (i = 0; i < totalNodeCount * 2; i++)
+				for (i = 0; i < totalNodeCount + totalRowCount; i++)
 				{
 					MIPSolutions[i] = sol[i];
 				}				
@@ -463,10 +474,11 @@ int main(int argc, char *argv[])
 			
 			forgeMIPStartSolution(sol);
 			
-			// Free model
-			GRBfreemodel(model);
-			
-		}while((objval - previousObjectiveValue) < 0); 		
+		}while(improved); 		
+		
+		// Empty the model for the next scenario's LP
+		error = clearSolver(&solver, "L1Approx");
+		if (error) goto QUIT;
 		
 		LPmodelError[k] = calculateError(totalNodeCount, LPSolutions);
 		MIPmodelError[k] = calculateError(totalNodeCount, MIPSolutions);
@@ -492,60 +504,8 @@ int main(int argc, char *argv[])
  				NULL);
  			if (error) goto QUIT;
  			 	
- 			// Add variables 
- 			for (i = 0; i < (totalNodeCount * 2); i++)
- 			{
- 				obj[i] = coefficients[i]; 			
- 				vtype[i] = GRB_CONTINUOUS; 			
- 			}
- 			
- 			for (i = (totalNodeCount * 2); i < (totalNodeCount * 3); i++)
- 			{
- 				obj[i] = 0.0;
- 				vtype[i] = GRB_BINARY;
- 			}
- 			 				
-			error = GRBaddvars(model, (totalNodeCount * 3), 0, NULL, NULL, NULL,
-				obj, NULL, NULL, vtype, NULL);
+			error = addL1Model(model, totalNodeCount, 1);
 			if (error) goto QUIT;
-			
-			// Integrate new variables		
-			error = GRBupdatemodel(model);
-			if (error) goto QUIT;
-					
-			// First constraint: Ax <= b						
-			for (i = 0; i < (totalNodeCount * 2); i++)
-			{
-				for (j = 0; j < (totalNodeCount * 2); j++)
-				{
-					ind[j] = j;
-					val[j] = Ahat[i][j];			
-				}								
-				error = GRBaddconstr(model, (totalNodeCount * 2), ind, val, 
-					GRB_LESS_EQUAL, bhat[i],NULL);			
-				if (error) goto QUIT;
-			}
-			
-			//Leak magnitude - (binary * bigM) <= 0
-			for (i = (totalNodeCount * 2); i < (totalNodeCount * 3); i++)
-			{		
-				ind[0] = (i - (totalNodeCount * 2)); 	ind[1] = i; 
-				val[0] = 1.0; 		val[1] = -bigM ;
-										
-				error = GRBaddconstr(model, 2, ind, val, GRB_LESS_EQUAL,0.0,
-					NULL);
-				if (error) goto QUIT;
-			}
-			
-			// Limit sum of binaries to number of leaks searching for...		
-			for (i = (totalNodeCount * 2); i < (totalNodeCount * 3); i++)
-			{		
-				ind[i-(totalNodeCount * 2)] = i;
-				val[i-(totalNodeCount * 2)] = 1.0;
-			}								
-			error = GRBaddconstr(model, totalNodeCount, ind, val, 
-				GRB_LESS_EQUAL, binaryLeakLimit,NULL);
-			if (error) goto QUIT;	
         	
 			error = GRBoptimize(model);
 			if (error) goto QUIT;
@@ -589,6 +549,10 @@ int main(int argc, char *argv[])
 		timePerIteration = ((double)(iterationEndTime - iterationStartTime)) / CLOCKS_PER_SEC;
 		
 		printf("\nSolution Time: %.9f\n", timePerIteration);
+		printf("EPANET Simulations: %d \t Cache Hits: %d \t Cache Misses: %d\n",
+			EPANETsimCounter, cacheHits, cacheMisses);
+		if (secantUpdates)
+			printf("Secant Updates: %d\n", secantCounter);
 		
 		writeSummaryFile(k, optimstatus, objval, sol);
 		writeRawResults(k, optimstatus, sol);
@@ -613,6 +577,10 @@ int main(int argc, char *argv[])
 	
 	free(leakNodes);	
 	free(MIPStartSolution);
+	free(sweepColumns);
+	free(secantColumns);
+	free(secantResponse);
+	free(secantMisfit);
 	free(baseCasePressureMatrix);	
 	free(observedPressure);	
 	free(coefficients);	
@@ -631,31 +599,24 @@ int main(int argc, char *argv[])
 	free(tempSolutions);
 	free(deltas);
 	free(previousDeltas);	
+	free(modelDeltas);
 	free(leakGuesses);
+	free(MIPStartMagnitudes);
 	
-	for(i = 0; i < totalNodeCount; i++)
-	{
-		free((void *)largePressureMatrix[i]);
-	}
-	free((void *)largePressureMatrix);
-	
-	for(i = 0; i < totalNodeCount; i++)
+	for(i = 0; i < totalNodeCount * sensitivityCacheSlots; i++)
 	{
-		free((void *)largeA[i]);
+		free((void *)cachedColumns[i]);
 	}
-	free((void *)largeA);
+	free((void *)cachedColumns);
+	free(cachedCoefficients);
+	free(cacheStamps);
 	
-	for(i = 0; i < totalNodeCount; i++)
-	{
-		free((void *)I[i]);
-	}
-	free((void *)I);
+	freeMatrix(&largePressureMatrix);
+	freeMatrix(&largeA);
+	freeLinearization(&linearization);
+	closeGGASolver(&ggaSolver);
+	free(reportTimes);
 	
-	for(i = 0; i < (totalNodeCount * 2); i++)
-	{
-		free((void *)Ahat[i]);
-	}
-	free((void *)Ahat);	
 	
 	
 	
@@ -664,16 +625,15 @@ int main(int argc, char *argv[])
 		// Error reporting
 		if (error) 
 		{
-			printf("ERROR: %s\n", GRBgeterrormsg(env));
+			printf("ERROR: %s\n", solverError(&solver));
 			exit(1);
 		}
 		
-		// Free model
-		GRBfreemodel(model);
-		
-		// Free environment
-		GRBfreeenv(env);
+		// Free model and environment
+		closeSolver(&solver);
 		
+	closeSession(&session);
+	closeNodeResults(&nodeResults);
 	ENclose();
 	
 	endTime = clock();
@@ -694,11 +654,14 @@ void initializeArrays()
 	delta = 1.0;
 	
 	//Array initialization	
-	for (i = 0; i < totalNodeCount; i++)
+	for (i = 0; i < totalRowCount; i++)
 	{
 		observedPressure[i] = 0;
-		baseCasePressureMatrix[i] = 0;
 		b[i] = 0;
+	}
+	
+	for (i = 0; i < totalNodeCount; i++)
+	{
 		realLeakValues[i] = 0.0;
 		singleRunErrors[i] = 0.0;
 		deltas[i] = delta;
@@ -711,57 +674,25 @@ void initializeArrays()
 		leakGuesses[i] = 0.0;
 	}
 	
-	for (i = 0; i < (totalNodeCount * 2); i++)
+	for (i = 0; i < (totalRowCount * 2); i++)
 	{
 		bhat[i] = 0;		
 	}
 	
-	for (i = 0; i < (totalNodeCount * 2); i++)
+	for (i = 0; i < (totalNodeCount + totalRowCount); i++)
 	{
 		coefficients[i] = 0;		
 	}
 	
-	for (i = 0; i < totalNodeCount; i++)
-	{
-		for (j = 0; j < totalNodeCount; j++)
-		{
-			largePressureMatrix[i][j] = 0;
-			largeA[i][j] = 0;		
-		}
-	}
-	
-	for (i = 0; i < (totalNodeCount * 2); i++)
-	{
-		for (j = 0; j < (totalNodeCount * 2); j++)
-		{
-			Ahat[i][j] = 0;		
-		}
-	}
-	
-	for (i = 0; i < totalNodeCount; i++)
-	{
-		for (j = 0; j < totalNodeCount; j++)
-		{
-			I[i][j] = 0;
-		}
-	}	
-
-	//Create Identity Matrix
-	for(i = 0; i < totalNodeCount; i++)
-	{
-		for (j = 0; j < totalNodeCount; j++)
-		{
-			if (i==j)
-				I[i][j] = 1;
-		}
-	}
+	clearMatrix(&largePressureMatrix);
+	clearMatrix(&largeA);
 	
 	//Create c-transpose
 	for (i = 0; i < totalNodeCount; i++)
 	{
 		coefficients[i] = 0.0;
 	}	
-	for (i = totalNodeCount; i < (totalNodeCount * 2); i++)
+	for (i = totalNodeCount; i < (totalNodeCount + totalRowCount); i++)
 	{
 		coefficients[i] = 1.0;
 	}
@@ -771,29 +702,29 @@ void initializeArrays()
 
 void populateBMatrix(int numNodes)
 {
-	int i, j;
+	int i, j, rows;
 	
 	//printf("local numNodes variable = %d", numNodes);
 	//getchar();
 	i = j = 0;
+	rows = numNodes * reportPeriods;
 	
 	
-	
-	for (i = 0; i < numNodes; i++)
+	for (i = 0; i < rows; i++)
 	{
 		b[i] = 0;
 	}
 	
 	
-	for (i = 0; i < (numNodes * 2); i++)
+	for (i = 0; i < (rows * 2); i++)
 	{
 		bhat[i] = 0;
 	}
 	
-	//Update b matrix
+	//Update b matrix, one row for every junction at each report time
 	
 
-	for (j = 0; j < numNodes; j++)
+	for (j = 0; j < rows; j++)
 	{
 		b[j] = (baseCasePressureMatrix[j] - observedPressure[j]);	
 		//printf("b[%d] = %f\n",i,b[i]);
@@ -802,10 +733,10 @@ void populateBMatrix(int numNodes)
 	
 	//Create b-hat
 	
-	for (i = 0; i < numNodes; i++)
+	for (i = 0; i < rows; i++)
 	{
 		bhat[i] = b[i];
-		bhat[i + numNodes] = -b[i];
+		bhat[i + rows] = -b[i];
 	}
 	
 	//for (i = numNodes; i < (numNodes * 2); i++)
@@ -819,104 +750,316 @@ void populateBMatrix(int numNodes)
 
 
 
+//FUNCTION
+//Add a leak magnitude column for every node, A over -A, plus a 1 in row 
+//	linkRow + j unless linkRow is negative. The columns are read straight 
+//	from largeA and go in chunks of at most modelChunk non-zeros, so the 
+//	staging block stays small and its int offsets cannot overflow on large 
+//	networks. Zero coefficients are left out
+int addLeakColumns(SolverModel *model, int numNodes, int linkRow)
+{
+	int i, j, first, nz, capacity, numRows, error;
+	int *vbeg, *vind;
+	double *vval, *column;
+	
+	numRows = largeA.rows;
+	capacity = numRows * 2 + 1;
+	if (capacity < modelChunk)
+		capacity = modelChunk;
+	
+	vbeg = (int *) malloc(numNodes * sizeof(int));
+	vind = (int *) malloc(capacity * sizeof(int));
+	vval = (double *) malloc(capacity * sizeof(double));
+	
+	error = first = nz = 0;
+	for (j = 0; j <= numNodes && !error; j++)
+	{
+		//Load the chunk once the next column might not fit, and at the end
+		if (j == numNodes || nz + numRows * 2 + 1 > capacity)
+		{
+			if (j > first)
+				error = solverAddColumns(model, j - first, nz, vbeg, vind, 
+					vval, coefficients + first, NULL, NULL);
+			first = j;
+			nz = 0;
+		}
+		if (j == numNodes)
+			break;
+		
+		column = MATRIX_COLUMN(largeA, j);
+		vbeg[j - first] = nz;
+		for (i = 0; i < numRows; i++)
+		{
+			if (column[i] == 0.0)
+				continue;
+			vind[nz] = i;
+			vval[nz] = column[i];
+			nz++;
+		}
+		for (i = 0; i < numRows; i++)
+		{
+			if (column[i] == 0.0)
+				continue;
+			vind[nz] = numRows + i;
+			vval[nz] = -column[i];
+			nz++;
+		}
+		if (linkRow >= 0)
+		{
+			vind[nz] = linkRow + j;
+			vval[nz] = 1.0;
+			nz++;
+		}
+	}
+	
+	free(vbeg);
+	free(vind);
+	free(vval);
+	
+	return error;
+}
+
+//FUNCTION
+//Add the L1 variables and rows, A x - e <= b and -A x - e <= -b, to an empty 
+//	model. The rows go in first without coefficients, then the leak 
+//	magnitudes with addLeakColumns and the remaining variables with one 
+//	solverAddColumns call, both in compressed sparse column form. With 
+//	binaries the linking rows of linkingFormulation and the leak cardinality
+//	row are part of the block. With stacked report times A has a row, and e
+//	an element, for every junction at each of them
+int addL1Model(SolverModel *model, int numNodes, int binaries)
+{
+	int i, rows, vars, nz, error, numRows, linkRow, binary, bigMRows;
+	int *vbeg, *vind;
+	double *vval, *rhs, *obj, *bounds;
+	char *sense, *vtype;
+	
+#if GRB_VERSION_MAJOR < 7
+	if (linkingFormulation == 3)
+	{
+		printf("\nIndicator constraints need Gurobi 7, using tight M rows\n");
+		linkingFormulation = 2;
+	}
+#endif
+	if (model->backend != SOLVER_GUROBI && (linkingFormulation == 1 || 
+		linkingFormulation == 3))
+	{
+		printf("\n%s has no SOS1 or indicator constraints, using tight M "
+			"rows\n", solverName(model));
+		linkingFormulation = 2;
+	}
+	
+	//Columns after the leak magnitudes are staged from 0, the binaries 
+	//	follow the residuals
+	numRows = largeA.rows;
+	linkRow = numRows * 2;
+	binary = numRows;
+	rows = numRows * 2;
+	vars = numRows;
+	nz = numRows * 2;
+	if (binaries)
+	{
+		rows += numNodes + 1;
+		vars += numNodes;
+		nz += numNodes * 3;
+		
+		//SOS1 pairs each leak magnitude with a slack for 1 - binary
+		if (linkingFormulation == 1)
+			vars += numNodes;
+	}
+	bigMRows = (linkingFormulation == 0 || linkingFormulation == 2);
+	
+	rhs = (double *) malloc(rows * sizeof(double));
+	sense = (char *) malloc(rows * sizeof(char));
+	vbeg = (int *) malloc(vars * sizeof(int));
+	obj = (double *) malloc(vars * sizeof(double));
+	vtype = (char *) malloc(vars * sizeof(char));
+	vind = (int *) malloc(nz * sizeof(int));
+	vval = (double *) malloc(nz * sizeof(double));
+	
+	for (i = 0; i < rows; i++)
+	{
+		sense[i] = GRB_LESS_EQUAL;
+		rhs[i] = 0.0;
+	}
+	for (i = 0; i < (numRows * 2); i++)
+	{
+		rhs[i] = bhat[i];
+	}
+	
+	// Limit sum of binaries to number of leaks searching for...
+	if (binaries)
+		rhs[linkRow + numNodes] = binaryLeakLimit;
+	
+	//Binary plus slack is one for the SOS1 pairs
+	for (i = 0; binaries && linkingFormulation == 1 && i < numNodes; i++)
+	{
+		sense[linkRow + i] = GRB_EQUAL;
+		rhs[linkRow + i] = 1.0;
+	}
+	
+	error = solverAddRows(model, rows, sense, rhs);
+	
+	//Leak magnitudes, with a 1 in their linking row for the M rows
+	if (!error)
+		error = addLeakColumns(model, numNodes, 
+			(binaries && bigMRows) ? linkRow : -1);
+	
+	//Residuals
+	nz = 0;
+	for (i = 0; i < numRows; i++)
+	{
+		vbeg[i] = nz;
+		vind[nz] = i;
+		vval[nz] = -1.0;
+		nz++;
+		vind[nz] = numRows + i;
+		vval[nz] = -1.0;
+		nz++;
+		obj[i] = coefficients[numNodes + i];
+		vtype[i] = GRB_CONTINUOUS;
+	}
+
+	if (binaries)
+	{	
+		bounds = (double *) malloc(numNodes * sizeof(double));
+		for (i = 0; i < numNodes; i++)
+		{
+			bounds[i] = bigM;
+		}
+		if (linkingFormulation == 2)
+			linkBounds(numNodes, bounds);
+		
+		//Leak magnitude - (binary * M) <= 0, or binary + slack = 1 for 
+		//	SOS1, and the cardinality row. Indicator constraints leave the 
+		//	linking rows empty
+		for (i = 0; i < numNodes; i++)
+		{
+			vbeg[binary + i] = nz;
+			if (linkingFormulation != 3)
+			{
+				vind[nz] = linkRow + i;
+				vval[nz] = bigMRows ? -bounds[i] : 1.0;
+				nz++;
+			}
+			vind[nz] = linkRow + numNodes;
+			vval[nz] = 1.0;
+			nz++;
+			obj[binary + i] = 0.0;
+			vtype[binary + i] = GRB_BINARY;
+		}
+		
+		for (i = 0; linkingFormulation == 1 && i < numNodes; i++)
+		{
+			vbeg[binary + numNodes + i] = nz;
+			vind[nz] = linkRow + i;
+			vval[nz] = 1.0;
+			nz++;
+			obj[binary + numNodes + i] = 0.0;
+			vtype[binary + numNodes + i] = GRB_CONTINUOUS;
+		}
+		
+		free(bounds);
+	}
+	
+	if (!error)
+		error = solverAddColumns(model, vars, nz, vbeg, vind, vval, obj, NULL, 
+			vtype);
+	if (!error && binaries)
+		error = addLinkConstraints(model, numNodes);
+	if (!error)
+		error = tightenBounds(model, numNodes);
+	
+	free(rhs);
+	free(sense);
+	free(vbeg);
+	free(obj);
+	free(vtype);
+	free(vind);
+	free(vval);
+	
+	return error;
+}
+
 //FUNCTION
 //Populate array values for the L1 Approximation
 //Also calls single leak simulations for each node in the network
 void populateMatricies(int numNodes)
 {
-	int i, j;
+	int i, j, rows;
+	double *pressures, *column;
 	
 	//printf("local numNodes variable = %d", numNodes);
 	//getchar();
 	i = j = 0;
+	rows = numNodes * reportPeriods;
 	
 	
-	for (i = 0; i < numNodes; i++)
+	for (i = 0; i < rows; i++)
 	{
 		b[i] = 0;		
 	}
 	
-	for (i = 0; i < (numNodes * 2); i++)
+	for (i = 0; i < (rows * 2); i++)
 	{
 		bhat[i] = 0;		
 	}
 	
 	//Update b matrix
-	for (i = 0; i < numNodes; i++)
+	for (i = 0; i < rows; i++)
 	{
 		b[i] = (baseCasePressureMatrix[i] - observedPressure[i]);	
 		//printf("b[%d] = %f\n",i,b[i]);
 	}
 	//getchar();
 	//Create b-hat
-	for (i = 0; i < numNodes; i++)
+	for (i = 0; i < rows; i++)
 	{
 		bhat[i] = b[i];
 	}
-	for (i = numNodes; i < (numNodes * 2); i++)
+	for (i = rows; i < (rows * 2); i++)
 	{
-		bhat[i] = -b[i-numNodes];
+		bhat[i] = -b[i-rows];
 		//printf("\t\t\t\tbhat[%d] = %f", i-numNodes, bhat[i-numNodes]);
 		//printf("\tbhat[%d] = %f\n", i, bhat[i]);
 	}
 	
 	
-	for(i = 1; i <= numNodes; i++)
-	{		
-		oneLeak(i, deltas[i-1], numNodes, i-1);		
-	}
+	sensitivitySweep(numNodes);
 	
-	//Update A matrix		
-	for(i = 0; i < numNodes; i++)
+	//Update A matrix, a column at a time
+	for(j = 0; j < numNodes; j++)
 	{		
-		for(j = 0; j < numNodes; j++)
+		//THIS MAY BE WRONG!!!
+		if(deltas[j] != 0)
 		{
-			//THIS MAY BE WRONG!!!
-			if(deltas[j] != 0)
+			pressures = MATRIX_COLUMN(largePressureMatrix, j);
+			column = MATRIX_COLUMN(largeA, j);
+			for(i = 0; i < rows; i++)
+			{
+				column[i] = (baseCasePressureMatrix[i] - pressures[i]) / 
+					deltas[j];
+			}
+			
+			//A column moved by a secant update is back to its simulated 
+			//	values, so the model has to be patched even if its delta
+			//	did not change
+			if (secantColumns[j])
 			{
-				largeA[i][j] = (baseCasePressureMatrix[i] - 
-					largePressureMatrix[i][j]) / deltas[j];
+				secantColumns[j] = 0;
+				modelDeltas[j] = 0.0;
 			}
 		}			
 	}	
+
 	
-	//Create A-hat
-	for(i = 0; i < numNodes; i++)
-	{
-		for(j = 0; j < numNodes; j++)
-		{
-			Ahat[i][j] =  largeA[i][j];
-		}
-	}
-	for(i = numNodes; i < (numNodes * 2); i++)
+	//Keep track of the emitter coefficient at every network node (most should
+	//	be zero)
+	for (i = 0; i < numOfLeaks; i++)
 	{
-		for(j = 0; j < numNodes; j++)
-		{
-			Ahat[i][j] = -largeA[i-numNodes][j];
-		}
-	}
-	for(i = 0; i < numNodes; i++)
-	{
-		for(j = numNodes; j < (numNodes * 2); j++)
-		{
-			Ahat[i][j] = -I[i][j-numNodes];
-		}
-	}
-	for(i = numNodes; i < (numNodes * 2); i++)
-	{
-		for(j = numNodes; j < (numNodes * 2); j++)
-		{
-			Ahat[i][j] = -I[i-numNodes][j-numNodes];
-		}
-	}
-	
-	//Keep track of the emitter coefficient at every network node (most should
-	//	be zero)
-	for (i = 0; i < numOfLeaks; i++)
-	{
-		//temp = (leakNodes[i]-1);		
-		//realLeakValues[temp] = leakMagnitudes[i];
-		realLeakValues[(leakNodes[i]-1)] = leakMagnitudes[i];
+		//temp = (leakNodes[i]-1);		
+		//realLeakValues[temp] = leakMagnitudes[i];
+		realLeakValues[(leakNodes[i]-1)] = leakMagnitudes[i];
 	}
 	
 }
@@ -984,41 +1127,332 @@ void printLeakInfo(int numOfLeaks)
 	}
 }
 
+//FUNCTION
+//Resolve analysisTime and end the simulation there, so every hydraulic run
+//	stops at the instant its pressures are read instead of stepping through
+//	the rest of EN_DURATION. A snapshot shifts the patterns to analysisTime
+//	and solves that single period. Also lays out the stacked report times, 
+//	reportInterval apart and ending at analysisTime
+void setAnalysisTime()
+{
+	long duration, patternStart;
+	int k;
+	
+	ENgettimeparam(EN_DURATION, &duration);
+	ENgettimeparam(EN_PATTERNSTART, &patternStart);
+	
+	if (analysisTime < 0 || analysisTime > duration)
+		analysisTime = duration;
+	
+	if (snapshotMode)
+	{
+		ENsettimeparam(EN_PATTERNSTART, patternStart + analysisTime);
+		analysisTime = 0;
+	}
+	
+	ENsettimeparam(EN_DURATION, analysisTime);
+	
+	//Report times before the start of the simulation are dropped
+	if (reportPeriods < 1 || reportInterval <= 0)
+		reportPeriods = 1;
+	if ((long)(reportPeriods - 1) * reportInterval > analysisTime)
+		reportPeriods = (int)(analysisTime / reportInterval) + 1;
+	
+	reportTimes = (long *) calloc(reportPeriods, sizeof(long));
+	for (k = 0; k < reportPeriods; k++)
+	{
+		reportTimes[k] = analysisTime - 
+			(long)(reportPeriods - 1 - k) * reportInterval;
+	}
+	
+	if (reportPeriods > 1)
+	{
+		//The toolkit cuts its hydraulic steps at every reporting time, so 
+		//	each report time is solved exactly
+		ENsettimeparam(EN_REPORTSTART, reportTimes[0]);
+		ENsettimeparam(EN_REPORTSTEP, reportInterval);
+		
+		//The linearized network and the built-in solver model one instant
+		if (sensitivityMode != 0)
+		{
+			printf("\nStacked report times need simulation, simulating every leak\n");
+			sensitivityMode = 0;
+		}
+	}
+}
+
+//FUNCTION
+//Period of report time t, -1 if pressures are not reported at t
+int reportPeriod(long t)
+{
+	int k;
+	
+	for (k = 0; k < reportPeriods; k++)
+	{
+		if (reportTimes[k] == t)
+			return k;
+	}
+	
+	return -1;
+}
+
 //FUNCTION
 //Runs the hydraulic analysis on the base case scenario
 void analyzeBaseCase(int nodeCount)
 {		
 	long t, tstep, hydraulicTimeStep, duration;
-	float pressure;
-	int i;	
+	double *pressures;
+	int i, period, formula;	
 	
 	i = 0;
-	pressure = 0.0;
 	EPANETsimCounter++;
 	
 	ENgettimeparam( EN_HYDSTEP, &hydraulicTimeStep );
 	ENgettimeparam( EN_DURATION, &duration );
 	
 	//Open and initialize the hydraulic solver
-	ENopenH();  
-	ENinitH(0);  
+	beginSolve(&session);
 
 	//Run the hydraulic solver one hydraulic time step at a time
 	do 
 	{  		
 		ENrunH(&t);		
-		// Retrieve hydraulic results for time t
-		for (i=1; i <= nodeCount; i++)
+		//Later solves start from the flows of the first time step
+		if (!session.baseFlows)
+			saveBaseFlows(&session);
+		// Retrieve hydraulic results at the report times
+		period = reportPeriod(t);
+		if (period >= 0)
 		{
-			ENgetnodevalue(i, EN_PRESSURE, &pressure);
-			//ENgetnodeid(i, name);
-			baseCasePressureMatrix[i-1] = pressure;		
+			pressures = readNodeResults(&nodeResults, EN_PRESSURE);
+			for (i = 0; i < nodeCount; i++)
+			{
+				baseCasePressureMatrix[period * nodeCount + i] = pressures[i];
+			}
 		}		
 		ENnextH(&tstep);  	
 	} while (tstep > 0); 
 	
-	//Close the hydraulic solver
-	ENcloseH();  
+	//Close the hydraulic solver, unless the session keeps it
+	endSolve(&session);
+	
+	//Both need the head loss formula, which the 2.0 toolkit does not 
+	//	report, so it is read from the input file
+	formula = (sensitivityMode != 0) ? headlossFormula(inputFile) : -1;
+	if (sensitivityMode != 0 && formula < 0)
+	{
+		printf("\nHead loss formula of %s unknown, simulating every leak\n", 
+			inputFile);
+		sensitivityMode = 0;
+	}
+	
+	//Linearize about the base case while its heads and flows are current
+	if (sensitivityMode == 1 && 
+		linearizeNetwork(&linearization, nodeCount, formula) != 0)
+	{
+		printf("\nNetwork could not be linearized, simulating every leak\n");
+		sensitivityMode = 0;
+	}
+	
+	//The built-in solver has to reproduce these pressures before it is used
+	if (sensitivityMode == 2 && 
+		openGGASolver(&ggaSolver, nodeCount, ggaTolerance, formula) != 0)
+	{
+		printf("\nBuilt-in solver does not match the base case, simulating every leak\n");
+		sensitivityMode = 0;
+	}
+	
+	//It also has to reproduce a few simulated leaks
+	if (sensitivityMode == 2 && checkGGASolver(nodeCount) != 0)
+	{
+		printf("\nBuilt-in solver does not match the check leaks, simulating every leak\n");
+		closeGGASolver(&ggaSolver);
+		sensitivityMode = 0;
+	}
+}
+
+//FUNCTION
+//Solve ggaChecks leaks spread evenly over the junctions with both EPANET and
+//	the built-in solver. Pump curves are refit through the base operating 
+//	point, so reproducing the base case alone does not show the perturbed 
+//	solves are right. The columns simulated here are redone by the sweep.
+//	Returns non-zero if a pressure differs by more than ggaTolerance
+int checkGGASolver(int nodeCount)
+{
+	int c, i, j, checks;
+	double worst, *built, *simulated;
+	
+	checks = (ggaChecks < nodeCount) ? ggaChecks : nodeCount;
+	built = (double *) malloc(nodeCount * sizeof(double));
+	worst = 0.0;
+	
+	for (c = 0; c < checks; c++)
+	{
+		j = (int)((long)c * nodeCount / checks);
+		
+		//A leak the built-in solver does not converge is simulated anyway
+		if (ggaOneLeak(&ggaSolver, j, delta, built) != 0)
+			continue;
+		
+		oneLeak(j + 1, delta, nodeCount, j);
+		simulated = MATRIX_COLUMN(largePressureMatrix, j);
+		for (i = 0; i < nodeCount; i++)
+		{
+			if (fabs(simulated[i] - built[i]) > worst)
+				worst = fabs(simulated[i] - built[i]);
+		}
+	}
+	
+	printf("\nBuilt-in solver checked against EPANET on %d leaks, largest "
+		"pressure difference %f\n", checks, worst);
+	
+	free(built);
+	
+	return (worst > ggaTolerance);
+}
+
+//FUNCTION
+//FNV-1a hash, used to key the base case store
+unsigned long long hashBytes(unsigned long long hash, const void *data, 
+	size_t length)
+{
+	const unsigned char *bytes;
+	size_t i;
+	
+	bytes = (const unsigned char *) data;
+	for (i = 0; i < length; i++)
+	{
+		hash ^= bytes[i];
+		hash *= 1099511628211ULL;
+	}
+	
+	return hash;
+}
+
+//FUNCTION
+//Key for the base case store, covering the network file contents, the 
+//	hydraulic options and the time settings of the run. Returns 0 (store 
+//	disabled) if the network file cannot be read
+unsigned long long baseCaseKey(int numNodes)
+{
+	int options[] = {EN_TRIALS, EN_ACCURACY, EN_TOLERANCE, EN_EMITEXPON, 
+		EN_DEMANDMULT};
+	int timeParameters[] = {EN_DURATION, EN_HYDSTEP, EN_PATTERNSTEP, 
+		EN_PATTERNSTART, EN_REPORTSTEP, EN_REPORTSTART};
+	unsigned long long key;
+	unsigned char buffer[4096];
+	size_t length;
+	float value;
+	long timeValue;
+	int i;
+	FILE *network;
+	
+	network = fopen(inputFile, "rb");
+	if (!network)
+		return 0;
+	
+	key = 14695981039346656037ULL;
+	while ((length = fread(buffer, 1, sizeof(buffer), network)) > 0)
+	{
+		key = hashBytes(key, buffer, length);
+	}
+	fclose(network);
+	
+	key = hashBytes(key, &numNodes, sizeof(int));
+	key = hashBytes(key, &reportPeriods, sizeof(int));
+	
+	for (i = 0; i < 5; i++)
+	{
+		ENgetoption(options[i], &value);
+		key = hashBytes(key, &value, sizeof(float));
+	}
+	for (i = 0; i < 6; i++)
+	{
+		ENgettimeparam(timeParameters[i], &timeValue);
+		key = hashBytes(key, &timeValue, sizeof(long));
+	}
+	
+	return key;
+}
+
+//Header written in front of the pressures in the base case store
+typedef struct
+{
+	char magic[8];
+	unsigned long long key;
+	int rows;
+} BaseCaseHeader;
+
+//FUNCTION
+//Fill baseCasePressureMatrix from the base case store. Returns 0 on 
+//	success, non-zero if there is no store or it was written for a different
+//	network or set of options
+int loadBaseCase(int numNodes)
+{
+	BaseCaseHeader header;
+	FILE *store;
+	int rows, error;
+	
+	if (baseCaseStore[0] == '\0' || baseKey == 0)
+		return 1;
+	
+	store = fopen(baseCaseStore, "rb");
+	if (!store)
+		return 1;
+	
+	rows = numNodes * reportPeriods;
+	error = (fread(&header, sizeof(header), 1, store) != 1 ||
+		memcmp(header.magic, "L1BASE1", 8) != 0 || header.key != baseKey ||
+		header.rows != rows);
+	if (!error)
+		error = (fread(baseCasePressureMatrix, sizeof(double), rows, store) != 
+			(size_t)rows);
+	fclose(store);
+	
+	if (!error)
+		printf("\nBase case loaded from %s\n", baseCaseStore);
+	
+	return error;
+}
+
+//FUNCTION
+//Write baseCasePressureMatrix to the base case store, under a temporary 
+//	name that is then renamed
+int saveBaseCase(int numNodes)
+{
+	BaseCaseHeader header;
+	char tempName[60];
+	FILE *store;
+	int error;
+	
+	if (baseCaseStore[0] == '\0' || baseKey == 0)
+		return 1;
+	
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, "L1BASE1", 8);
+	header.key = baseKey;
+	header.rows = numNodes * reportPeriods;
+	
+	sprintf(tempName, "%s.tmp", baseCaseStore);
+	store = fopen(tempName, "wb");
+	if (!store)
+		return 1;
+	
+	error = (fwrite(&header, sizeof(header), 1, store) != 1 ||
+		fwrite(baseCasePressureMatrix, sizeof(double), header.rows, store) != 
+		(size_t)header.rows);
+	if (fclose(store) != 0)
+		error = 1;
+	if (!error)
+		error = rename(tempName, baseCaseStore);
+	
+	if (error)
+	{
+		remove(tempName);
+		printf("\nCould not write base case store %s\n", baseCaseStore);
+	}
+	
+	return error;
 }
 
 //FUNCTION
@@ -1026,53 +1460,611 @@ void analyzeBaseCase(int nodeCount)
 //Determines how many pressure violations occur in the network by leak location
 void oneLeak(int index, double emitterCoeff, int nodeCount, int columnNumber) 
 {	
-	int i;
-	long t, tstep, hydraulicTimeStep;
-	float pressure;
+	int period;
+	long t, tstep;
+	double *pressures;
 	
-	i = 0;
-	pressure = 0;
 	EPANETsimCounter++;
 	
-	ENgettimeparam(EN_HYDSTEP, &hydraulicTimeStep);
-	
 	//Create the leak
 	ENsetnodevalue(index, EN_EMITTER, emitterCoeff);
 	
-	ENopenH();  
-	ENinitH(0);
+	beginSolve(&session);
 
 	//Run the hydraulic analysis
 	do {  	
 		ENrunH(&t);		
-		if (t%hydraulicTimeStep == 0)
+		period = reportPeriod(t);
+		if (period >= 0)
 		{
-			for (i = 1; i <= nodeCount; i++)
-			{			
-				ENgetnodevalue(i, EN_PRESSURE, &pressure);
-				largePressureMatrix[i-1][columnNumber] = pressure;			
-            }
-         }
+			pressures = readNodeResults(&nodeResults, EN_PRESSURE);
+			memcpy(MATRIX_COLUMN(largePressureMatrix, columnNumber) + 
+				period * nodeCount, pressures, nodeCount * sizeof(double));
+		}
 		ENnextH(&tstep); 
 	} while (tstep > 0); 
 	
-	//Close the hydraulic solver
-	ENcloseH();
+	//Close the hydraulic solver, unless the session keeps it
+	endSolve(&session);
 	
 	//"Fix" the leak
 	ENsetnodevalue(index, EN_EMITTER, 0.0);
 }
 
+//FUNCTION
+//Run the single leak simulation for every node, filling one column of 
+//	largePressureMatrix per node. Columns already simulated with the same 
+//	emitter coefficient are copied from the column cache, the rest are run on
+//	worker threads when built against EPANET 2.2 and sensitivityThreads > 1,
+//	forked worker processes when sensitivityProcesses > 1, otherwise on the
+//	global project
+void sensitivitySweep(int numNodes)
+{
+	int i, count, simulated;
+	
+	i = count = simulated = 0;
+	
+	for (i = 0; i < numNodes; i++)
+	{
+		if (!loadCachedColumn(i, deltas[i], numNodes))
+			sweepColumns[count++] = i;
+	}
+	
+	if (count > 0 && sensitivityMode == 1)
+	{
+		for (i = 0; i < count; i++)
+		{
+			linearizedPressures(&linearization, sweepColumns[i], 
+				deltas[sweepColumns[i]], 
+				MATRIX_COLUMN(largePressureMatrix, sweepColumns[i]));
+		}
+		simulated = 1;
+	}
+	
+	//Columns the built-in solver cannot converge are simulated instead
+	if (count > 0 && sensitivityMode == 2)
+	{
+		for (i = 0; i < count; i++)
+		{
+			if (ggaOneLeak(&ggaSolver, sweepColumns[i], deltas[sweepColumns[i]], 
+				MATRIX_COLUMN(largePressureMatrix, sweepColumns[i])) != 0)
+				oneLeak(sweepColumns[i] + 1, deltas[sweepColumns[i]], numNodes,
+					sweepColumns[i]);
+		}
+		simulated = 1;
+	}
+	
+#ifdef EPANET_2_2
+	if (!simulated && count > 0 && sensitivityThreads > 1)
+		simulated = (threadedOneLeaks(sweepColumns, count, numNodes) == 0);
+#endif
+	if (!simulated && count > 0 && largePressureMatrix.shared)
+		simulated = (forkedOneLeaks(sweepColumns, count, numNodes) == 0);
+	
+	if (!simulated)
+	{
+		for(i = 0; i < count; i++)
+		{		
+			oneLeak(sweepColumns[i] + 1, deltas[sweepColumns[i]], numNodes,
+				sweepColumns[i]);		
+		}
+	}
+	
+	for (i = 0; i < count; i++)
+	{
+		storeCachedColumn(sweepColumns[i], deltas[sweepColumns[i]], numNodes);
+	}
+}
+
+//FUNCTION
+//Copy the cached pressures for a node/emitter coefficient pair into its 
+//	column of largePressureMatrix. Returns 1 on a hit, 0 on a miss
+int loadCachedColumn(int column, double emitterCoeff, int numNodes)
+{
+	int slot;
+	
+	for (slot = column * sensitivityCacheSlots; 
+		slot < (column + 1) * sensitivityCacheSlots; slot++)
+	{
+		if (cachedColumns[slot] != NULL && 
+			cachedCoefficients[slot] == emitterCoeff)
+		{
+			memcpy(MATRIX_COLUMN(largePressureMatrix, column), 
+				cachedColumns[slot], largePressureMatrix.rows * sizeof(double));
+			cacheStamps[slot] = ++cacheClock;
+			cacheHits++;
+			return 1;
+		}
+	}
+	
+	cacheMisses++;
+	return 0;
+}
+
+//FUNCTION
+//Keep a freshly simulated column, replacing the least recently used slot 
+//	for that node
+void storeCachedColumn(int column, double emitterCoeff, int numNodes)
+{
+	int slot, oldest;
+	
+	if (sensitivityCacheSlots < 1)
+		return;
+	
+	oldest = column * sensitivityCacheSlots;
+	for (slot = oldest; slot < (column + 1) * sensitivityCacheSlots; slot++)
+	{
+		if (cacheStamps[slot] < cacheStamps[oldest])
+			oldest = slot;
+	}
+	
+	if (cachedColumns[oldest] == NULL)
+		cachedColumns[oldest] = (double *) calloc(largePressureMatrix.rows, 
+			sizeof(double));
+	
+	memcpy(cachedColumns[oldest], MATRIX_COLUMN(largePressureMatrix, column), 
+		largePressureMatrix.rows * sizeof(double));
+	cachedCoefficients[oldest] = emitterCoeff;
+	cacheStamps[oldest] = ++cacheClock;
+}
+
+//FUNCTION
+//Multi-process version of the single leak loop for the legacy toolkit. Each 
+//	child is forked with the network already open and simulates a contiguous
+//	range of the listed columns straight into the shared largePressureMatrix.
+//	Ranges whose worker could not be forked or did not exit cleanly are 
+//	redone here
+int forkedOneLeaks(int *columns, int count, int numNodes)
+{
+	pid_t *workers;
+	int i, w, first, last, status;
+	
+	workers = (pid_t *) calloc(sensitivityProcesses, sizeof(pid_t));
+	
+	//Anything still buffered would otherwise be written once per child
+	fflush(NULL);
+	
+	for (w = 0; w < sensitivityProcesses; w++)
+	{
+		first = (w * count) / sensitivityProcesses;
+		last = ((w + 1) * count) / sensitivityProcesses;
+		
+		workers[w] = fork();
+		if (workers[w] == 0)
+		{
+			for(i = first; i < last; i++)
+			{
+				oneLeak(columns[i] + 1, deltas[columns[i]], numNodes, 
+					columns[i]);
+			}
+			_exit(0);
+		}
+	}
+	
+	for (w = 0; w < sensitivityProcesses; w++)
+	{
+		status = 1;
+		if (workers[w] > 0)
+			waitpid(workers[w], &status, 0);
+		
+		first = (w * count) / sensitivityProcesses;
+		last = ((w + 1) * count) / sensitivityProcesses;
+		
+		if (WIFEXITED(status) && WEXITSTATUS(status) == 0)
+		{
+			EPANETsimCounter += (last - first);
+		}
+		else
+		{
+			printf("\nSensitivity worker %d failed, running its nodes here\n", w);
+			for(i = first; i < last; i++)
+			{
+				oneLeak(columns[i] + 1, deltas[columns[i]], numNodes, 
+					columns[i]);
+			}
+		}
+	}
+	
+	free(workers);
+	return 0;
+}
+
+#ifdef EPANET_2_2
+//Work shared by the sensitivity threads, columns are handed out one at a time
+//	so that slow simulations do not leave the other threads idle
+typedef struct
+{
+	EN_Project project;
+	double *pressures; //Every node, filled by EN_getnodevalues
+	int nodeCount;
+	int *columns;
+	int columnCount;
+	int *nextColumn;
+	pthread_mutex_t *lock;
+} SweepWorker;
+
+//FUNCTION
+//Thread body for the parallel sweep, simulates columns until none are left
+void *oneLeakWorker(void *arg)
+{
+	SweepWorker *worker;
+	int next, column, count;
+	
+	worker = (SweepWorker *) arg;
+	
+	EN_getcount(worker->project, EN_NODECOUNT, &count);
+	worker->pressures = (double *) calloc(count, sizeof(double));
+	
+	//A persistent session holds the worker's solver open for all its columns
+	if (hydraulicSession)
+		EN_openH(worker->project);
+	
+	do
+	{
+		pthread_mutex_lock(worker->lock);
+		next = *(worker->nextColumn);
+		if (next < worker->columnCount)
+			(*(worker->nextColumn))++;
+		pthread_mutex_unlock(worker->lock);
+		
+		if (next < worker->columnCount)
+		{
+			column = worker->columns[next];
+			projectOneLeak(worker->project, column + 1, deltas[column], 
+				worker->nodeCount, column, worker->pressures);
+		}
+	} while (next < worker->columnCount);
+	
+	if (hydraulicSession)
+		EN_closeH(worker->project);
+	free(worker->pressures);
+	
+	return NULL;
+}
+
+//FUNCTION
+//Parallel version of the single leak loop over the listed columns. Every 
+//	worker opens its own copy of the network since the legacy toolkit state 
+//	cannot be shared between threads. Returns non-zero if the workers could 
+//	not be set up, in which case nothing has been simulated
+int threadedOneLeaks(int *columns, int count, int numNodes)
+{
+	SweepWorker *workers;
+	pthread_t *threads;
+	pthread_mutex_t lock;
+	int i, numWorkers, opened, nextColumn, error;
+	long patternStart, reportStart, reportStep;
+	char *started;
+	
+	numWorkers = sensitivityThreads;
+	if (numWorkers > count)
+		numWorkers = count;
+	opened = nextColumn = error = 0;
+	
+	workers = (SweepWorker *) calloc(numWorkers, sizeof(SweepWorker));
+	threads = (pthread_t *) calloc(numWorkers, sizeof(pthread_t));
+	started = (char *) calloc(numWorkers, sizeof(char));
+	pthread_mutex_init(&lock, NULL);
+	
+	ENgettimeparam(EN_PATTERNSTART, &patternStart);
+	ENgettimeparam(EN_REPORTSTART, &reportStart);
+	ENgettimeparam(EN_REPORTSTEP, &reportStep);
+	
+	for (i = 0; i < numWorkers; i++)
+	{
+		workers[i].nodeCount = numNodes;
+		workers[i].columns = columns;
+		workers[i].columnCount = count;
+		workers[i].nextColumn = &nextColumn;
+		workers[i].lock = &lock;
+		
+		error = EN_createproject(&workers[i].project);
+		if (error) 
+			break;
+		opened++;
+		
+		error = EN_open(workers[i].project, inputFile, "", "");
+		if (error)
+			break;
+		
+		//Stop at the same instant as the global project
+		EN_settimeparam(workers[i].project, EN_PATTERNSTART, patternStart);
+		EN_settimeparam(workers[i].project, EN_DURATION, analysisTime);
+		EN_settimeparam(workers[i].project, EN_REPORTSTART, reportStart);
+		EN_settimeparam(workers[i].project, EN_REPORTSTEP, reportStep);
+	}
+	
+	if (!error)
+	{
+		for (i = 0; i < numWorkers; i++)
+		{
+			if (pthread_create(&threads[i], NULL, oneLeakWorker, &workers[i])
+				== 0)
+				started[i] = 1;
+		}
+		
+		//Any worker that failed to start is run here, it simply drains 
+		//	whatever columns the other threads have not taken yet
+		for (i = 0; i < numWorkers; i++)
+		{
+			if (started[i])
+				pthread_join(threads[i], NULL);
+			else
+				oneLeakWorker(&workers[i]);
+		}
+		EPANETsimCounter += count;
+	}
+	else
+	{
+		printf("\nParallel sensitivity unavailable (EPANET error %d)\n", error);
+	}
+	
+	for (i = 0; i < opened; i++)
+	{
+		EN_close(workers[i].project);
+		EN_deleteproject(workers[i].project);
+	}
+	
+	pthread_mutex_destroy(&lock);
+	free(workers);
+	free(threads);
+	free(started);
+	
+	return error;
+}
+
+//FUNCTION
+//oneLeak against an independent project handle. Values go through float on
+//	the way in and out so the columns match the legacy ENxxx calls exactly
+void projectOneLeak(EN_Project ph, int index, double emitterCoeff, 
+	int nodeCount, int columnNumber, double *pressures) 
+{	
+	int i, period;
+	long t, tstep;
+	
+	i = 0;
+	
+	//Create the leak
+	EN_setnodevalue(ph, index, EN_EMITTER, (float)emitterCoeff);
+	
+	//In a persistent session the worker holds the solver open, otherwise it
+	//	is opened for this column alone. Either way the column starts from 
+	//	the base case flows or the toolkit's defaults, as the serial oneLeak 
+	//	does
+	if (!hydraulicSession)
+		EN_openH(ph);
+	initProjectSolve(&session, ph, !hydraulicSession);
+
+	//Run the hydraulic analysis
+	do {  	
+		EN_runH(ph, &t);		
+		period = reportPeriod(t);
+		if (period >= 0)
+		{
+			EN_getnodevalues(ph, EN_PRESSURE, pressures);
+			for (i = 0; i < nodeCount; i++)
+			{
+				MATRIX(largePressureMatrix, period * nodeCount + i, 
+					columnNumber) = (float)pressures[i];
+			}
+		}
+		EN_nextH(ph, &tstep); 
+	} while (tstep > 0); 
+	
+	if (!hydraulicSession)
+		EN_closeH(ph);
+	
+	//"Fix" the leak
+	EN_setnodevalue(ph, index, EN_EMITTER, 0.0);
+}
+#endif
+
+//FUNCTION
+//Largest leak magnitude an optimal solution can put at each node. With 
+//	x >= 0 and every column sum s_j of A non-negative, as leaks only lower
+//	pressures, |A x - b| >= x_j s_j - |b|, so a solution with x_j > 2 |b| / 
+//	s_j is worse than no leak at all. A bound is never set below 
+//	maxLeakSize, so the leaks that made the observations stay feasible. 
+//	Returns the number of nodes bounded, the rest are left at GRB_INFINITY
+int leakBounds(int numNodes, double *bounds)
+{
+	int i, j, rows, count;
+	double observed, sum, *column;
+	
+	rows = largeA.rows;
+	observed = 0.0;
+	for (i = 0; i < rows; i++)
+	{
+		observed += fabs(b[i]);
+	}
+	
+	count = 0;
+	for (j = 0; j < numNodes; j++)
+	{
+		column = MATRIX_COLUMN(largeA, j);
+		sum = 0.0;
+		for (i = 0; i < rows; i++)
+		{
+			sum += column[i];
+		}
+		
+		bounds[j] = GRB_INFINITY;
+		if (sum < 0.0)
+		{
+			//The bound does not hold for any node
+			for (j = 0; j < numNodes; j++)
+			{
+				bounds[j] = GRB_INFINITY;
+			}
+			return 0;
+		}
+		if (sum > 0.0)
+		{
+			bounds[j] = 2.0 * observed / sum;
+			if (bounds[j] < maxLeakSize)
+				bounds[j] = maxLeakSize;
+			count++;
+		}
+	}
+	
+	return count;
+}
+
+//FUNCTION
+//Bound the leak magnitudes with leakBounds and every residual with |b|, the
+//	objective of the no leak solution, before a solve. Has to be redone 
+//	whenever b or A changes
+int tightenBounds(SolverModel *model, int numNodes)
+{
+	int i, rows, count, error;
+	double observed, *upper;
+	
+	if (!boundTightening)
+		return 0;
+	
+	rows = largeA.rows;
+	upper = (double *) malloc((numNodes + rows) * sizeof(double));
+	
+	count = leakBounds(numNodes, upper);
+	
+	observed = 0.0;
+	for (i = 0; i < rows; i++)
+	{
+		observed += fabs(b[i]);
+	}
+	for (i = 0; i < rows; i++)
+	{
+		upper[numNodes + i] = observed;
+	}
+	
+	error = solverSetUpper(model, 0, numNodes + rows, upper);
+	if (!error)
+		printf("\nBounds tightened: %d of %d leak magnitudes, %d residuals\n", 
+			count, numNodes, rows);
+	
+	free(upper);
+	
+	return error;
+}
+
+//FUNCTION
+//Per node M for the tight linking rows, the leak bounds capped at bigM
+void linkBounds(int numNodes, double *bounds)
+{
+	int j;
+	
+	leakBounds(numNodes, bounds);
+	for (j = 0; j < numNodes; j++)
+	{
+		if (bounds[j] > bigM)
+			bounds[j] = bigM;
+	}
+}
+
+//FUNCTION
+//Recompute the tight M of every linking row after b or A changed
+int updateLinkBounds(SolverModel *model, int numNodes)
+{
+	int i, error, *cind, *vind;
+	double *cval;
+	
+	if (linkingFormulation != 2)
+		return 0;
+	
+	cind = (int *) malloc(numNodes * sizeof(int));
+	vind = (int *) malloc(numNodes * sizeof(int));
+	cval = (double *) malloc(numNodes * sizeof(double));
+	
+	linkBounds(numNodes, cval);
+	for (i = 0; i < numNodes; i++)
+	{
+		cind[i] = largeA.rows * 2 + i;
+		vind[i] = numNodes + largeA.rows + i;
+		cval[i] = -cval[i];
+	}
+	
+	error = solverChangeCoeffs(model, numNodes, cind, vind, cval);
+	
+	free(cind);
+	free(vind);
+	free(cval);
+	
+	return error;
+}
+
+//FUNCTION
+//Link each leak magnitude to its binary with the SOS1 pairs or indicator 
+//	constraints of linkingFormulation, once the variables are in the model.
+//	Both are Gurobi only, addL1Model gives other backends tight M rows
+int addLinkConstraints(SolverModel *model, int numNodes)
+{
+	int i, error, binary, *types, *beg, *ind;
+	double *weights;
+	
+	binary = numNodes + largeA.rows;
+	error = 0;
+	
+	if (model->backend != SOLVER_GUROBI)
+		return 0;
+	
+	if (linkingFormulation == 1)
+	{
+		//Either the leak magnitude or the slack 1 - binary is zero
+		types = (int *) malloc(numNodes * sizeof(int));
+		beg = (int *) malloc(numNodes * sizeof(int));
+		ind = (int *) malloc(numNodes * 2 * sizeof(int));
+		weights = (double *) malloc(numNodes * 2 * sizeof(double));
+		
+		for (i = 0; i < numNodes; i++)
+		{
+			types[i] = GRB_SOS_TYPE1;
+			beg[i] = i * 2;
+			ind[i * 2] = i;
+			ind[i * 2 + 1] = binary + numNodes + i;
+			weights[i * 2] = 1.0;
+			weights[i * 2 + 1] = 2.0;
+		}
+		
+		error = GRBaddsos(model->model, numNodes, numNodes * 2, types, beg, 
+			ind, weights);
+		
+		free(types);
+		free(beg);
+		free(ind);
+		free(weights);
+	}
+	
+#if GRB_VERSION_MAJOR >= 7
+	if (linkingFormulation == 3)
+	{
+		double one = 1.0;
+		
+		//Binary at 0 forces the leak magnitude to 0
+		for (i = 0; i < numNodes && !error; i++)
+		{
+			error = GRBaddgenconstrIndicator(model->model, NULL, binary + i, 0, 
+				1, &i, &one, GRB_LESS_EQUAL, 0.0);
+		}
+	}
+#endif
+	
+	if (!error)
+		error = GRBupdatemodel(model->model);
+	
+	return error;
+}
+
 //FUNCTION
 //Generalized multi-leak simulator
 void nLeaks(int leakCount, int nodeCount) 
 {
 	long t, tstep, hydraulicTimeStep, duration;	
-	float pressure, baseDemand, demand;
-	int i;
+	float baseDemand;
+	double *values;
+	int i, period;
 
 	i = 0;
-	totalDemand = pressure = baseDemand = demand = 0.0;
+	totalDemand = baseDemand = 0.0;
 	EPANETsimCounter++;
 	
 	ENgettimeparam(EN_HYDSTEP, &hydraulicTimeStep);
@@ -1086,34 +2078,42 @@ void nLeaks(int leakCount, int nodeCount)
 		ENsetnodevalue(leakNodes[i], EN_EMITTER, leakMagnitudes[i]);
 	}
 	
-	ENopenH();  
-	ENinitH(0);
+	beginSolve(&session);
 	
 	//Run the hydraulic analysis
 	do 
 	{  	
 		ENrunH(&t);
 		
-		for (i = 1; i <= nodeCount; i++)
-		{			
-			ENgetnodevalue(i, EN_PRESSURE, &pressure);						
-			ENgetnodevalue(i, EN_DEMAND, &demand);												
-			observedPressure[i-1] = (double)pressure;			
-			totalDemand += demand;	
+		period = reportPeriod(t);
+		if (period >= 0)
+		{
+			values = readNodeResults(&nodeResults, EN_PRESSURE);
+			memcpy(&observedPressure[period * nodeCount], values, 
+				nodeCount * sizeof(double));
 		}
 		
-		for (i = 0; i < leakCount; i++)
+		//Demands are summarized at the analysis time only
+		if (t == analysisTime)
 		{
-			ENgetnodevalue(leakNodes[i], EN_BASEDEMAND, &baseDemand);					
-			ENgetnodevalue(leakNodes[i], EN_DEMAND, &demand);			
-			leakDemands[i] = (demand - baseDemand);
+			values = readNodeResults(&nodeResults, EN_DEMAND);
+			for (i = 0; i < nodeCount; i++)
+			{
+				totalDemand += values[i];
+			}
+			
+			for (i = 0; i < leakCount; i++)
+			{
+				ENgetnodevalue(leakNodes[i], EN_BASEDEMAND, &baseDemand);
+				leakDemands[i] = (values[leakNodes[i]-1] - baseDemand);
+			}
 		}
 		
 		ENnextH(&tstep); 		
 	} while (tstep > 0); 
 	
-	//Close the hydraulic solver
-	ENcloseH();
+	//Close the hydraulic solver, unless the session keeps it
+	endSolve(&session);
 	
 	//"Fix" the leak
 	for (i = 0; i < leakCount; i++)
@@ -1122,6 +2122,175 @@ void nLeaks(int leakCount, int nodeCount)
 	}	
 }
 
+//FUNCTION
+//Pressure drop below the base case with a leak of emitter coefficient x[j]
+//	at every junction where x[j] > 0, the response the secant model is 
+//	checked against
+void supportLeaks(int nodeCount, double *x, double *response)
+{
+	long t, tstep;
+	double *pressures;
+	int i, period;
+	
+	EPANETsimCounter++;
+	
+	for (i = 0; i < nodeCount; i++)
+	{
+		if (x[i] > 0.0)
+			ENsetnodevalue(i + 1, EN_EMITTER, x[i]);
+	}
+	
+	beginSolve(&session);
+	
+	do 
+	{
+		ENrunH(&t);
+		period = reportPeriod(t);
+		if (period >= 0)
+		{
+			pressures = readNodeResults(&nodeResults, EN_PRESSURE);
+			for (i = 0; i < nodeCount; i++)
+			{
+				response[period * nodeCount + i] = 
+					baseCasePressureMatrix[period * nodeCount + i] - pressures[i];
+			}
+		}
+		ENnextH(&tstep);
+	} while (tstep > 0);
+	
+	endSolve(&session);
+	
+	for (i = 0; i < nodeCount; i++)
+	{
+		if (x[i] > 0.0)
+			ENsetnodevalue(i + 1, EN_EMITTER, 0.0);
+	}
+}
+
+//FUNCTION
+//Broyden update of largeA from the last solution x instead of simulating the
+//	support columns again. One simulation of every leak in x gives the true
+//	pressure drop y, and the support columns are moved by the least change 
+//	that makes A x = y. Returns non-zero, leaving largeA alone, if the model
+//	missed y by more than secantTolerance (relative L1), in which case the
+//	columns have to be simulated
+int secantUpdate(int numNodes, double *x)
+{
+	int i, j, rows;
+	double xx, misfit, scale, *column;
+	
+	rows = largeA.rows;
+	xx = 0.0;
+	for (j = 0; j < numNodes; j++)
+	{
+		if (x[j] > 0.0)
+			xx += x[j] * x[j];
+	}
+	if (xx == 0.0)
+		return 1;
+	
+	supportLeaks(numNodes, x, secantResponse);
+	
+	//Misfit of the current model, y - A x
+	for (i = 0; i < rows; i++)
+	{
+		secantMisfit[i] = secantResponse[i];
+	}
+	for (j = 0; j < numNodes; j++)
+	{
+		if (x[j] <= 0.0)
+			continue;
+		column = MATRIX_COLUMN(largeA, j);
+		for (i = 0; i < rows; i++)
+		{
+			secantMisfit[i] -= column[i] * x[j];
+		}
+	}
+	
+	misfit = scale = 0.0;
+	for (i = 0; i < rows; i++)
+	{
+		misfit += fabs(secantMisfit[i]);
+		scale += fabs(secantResponse[i]);
+	}
+	if (scale == 0.0 || misfit > secantTolerance * scale)
+		return 1;
+	
+	for (j = 0; j < numNodes; j++)
+	{
+		if (x[j] <= 0.0)
+			continue;
+		column = MATRIX_COLUMN(largeA, j);
+		for (i = 0; i < rows; i++)
+		{
+			column[i] += secantMisfit[i] * x[j] / xx;
+		}
+		
+		//The column no longer matches its delta, the model is patched with it
+		secantColumns[j] = 1;
+		modelDeltas[j] = 0.0;
+	}
+	
+	secantCounter++;
+	return 0;
+}
+
+//FUNCTION
+//Patch the A-block columns whose delta changed since the model was built or
+//	last patched, in place with solverChangeCoeffs. modelDeltas holds the 
+//	deltas the model's coefficients currently correspond to, 0 marks a 
+//	column that has to be patched regardless
+int updateModelColumns(SolverModel *model, int numNodes)
+{
+	int i, j, count, error, numRows;
+	int *cind, *vind;
+	double *cval;
+	
+	count = error = 0;
+	numRows = largeA.rows;
+	
+	for (j = 0; j < numNodes; j++)
+	{
+		if (deltas[j] != modelDeltas[j])
+			count++;
+	}
+	if (count == 0)
+		return 0;
+	
+	cind = (int *) malloc((size_t)count * numRows * 2 * sizeof(int));
+	vind = (int *) malloc((size_t)count * numRows * 2 * sizeof(int));
+	cval = (double *) malloc((size_t)count * numRows * 2 * sizeof(double));
+	
+	count = 0;
+	for (j = 0; j < numNodes; j++)
+	{
+		if (deltas[j] == modelDeltas[j])
+			continue;
+		
+		for (i = 0; i < numRows; i++)
+		{
+			cind[count] = i;
+			vind[count] = j;
+			cval[count] = MATRIX(largeA, i, j);
+			count++;
+			
+			cind[count] = i + numRows;
+			vind[count] = j;
+			cval[count] = -MATRIX(largeA, i, j);
+			count++;
+		}
+		modelDeltas[j] = deltas[j];
+	}
+	
+	error = solverChangeCoeffs(model, count, cind, vind, cval);
+	
+	free(cind);
+	free(vind);
+	free(cval);
+	
+	return error;
+}
+
 //FUNCTION
 //Find the n highest leak magnitudes in the current solution
 void findHighestMagnitudes(double *solutions)
@@ -1176,10 +2345,112 @@ void forgeMIPStartSolution(double sol[])
 	{
 		if (sol[i] >= minLeakThreshold)
 			MIPStartSolution[i] = 1;
+		MIPStartMagnitudes[i] = sol[i];
 	}
 	
 }
 
+//FUNCTION
+//Seed the MIP from the last LP or MIP magnitudes. On Gurobi the binaries 
+//	get branch priorities and, with Gurobi 7 or later, hints ranked by the 
+//	pressure drop each node explains, its magnitude times the L1 norm of 
+//	its column of A. The leak magnitudes, residuals and SOS1 slacks get 
+//	starts that complete the binary start, with the residuals recomputed 
+//	against the current A so the start is feasible
+int guideMIP(SolverModel *model, int numNodes)
+{
+	int i, j, rows, binary, error, *priorities, *hints;
+	double best, *scores, *starts, *column;
+	
+	if (!mipGuidance)
+		return 0;
+	
+	rows = largeA.rows;
+	binary = numNodes + rows;
+	
+	priorities = (int *) calloc(numNodes, sizeof(int));
+	hints = (int *) calloc(numNodes, sizeof(int));
+	scores = (double *) calloc(numNodes, sizeof(double));
+	starts = (double *) calloc(numNodes + rows, sizeof(double));
+	
+	best = 0.0;
+	for (j = 0; j < numNodes; j++)
+	{
+		column = MATRIX_COLUMN(largeA, j);
+		for (i = 0; i < rows; i++)
+		{
+			scores[j] += fabs(column[i]);
+		}
+		scores[j] *= MIPStartMagnitudes[j];
+		if (scores[j] > best)
+			best = scores[j];
+	}
+	
+	//Priorities run from 1 to 101, nodes the magnitudes leave out stay at 0
+	for (j = 0; j < numNodes && best > 0.0; j++)
+	{
+		if (scores[j] > 0.0)
+			priorities[j] = 1 + (int)(100.0 * scores[j] / best);
+		hints[j] = MIPStartSolution[j];
+	}
+	
+	//Leak magnitudes of the start, then residuals |b - A x|
+	for (j = 0; j < numNodes; j++)
+	{
+		if (MIPStartSolution[j])
+			starts[j] = MIPStartMagnitudes[j];
+	}
+	for (i = 0; i < rows; i++)
+	{
+		starts[numNodes + i] = b[i];
+	}
+	for (j = 0; j < numNodes; j++)
+	{
+		if (starts[j] == 0.0)
+			continue;
+		column = MATRIX_COLUMN(largeA, j);
+		for (i = 0; i < rows; i++)
+		{
+			starts[numNodes + i] -= column[i] * starts[j];
+		}
+	}
+	for (i = 0; i < rows; i++)
+	{
+		starts[numNodes + i] = fabs(starts[numNodes + i]);
+	}
+	
+	error = solverSetStart(model, 0, numNodes + rows, starts);
+	if (!error && model->backend == SOLVER_GUROBI)
+		error = GRBsetintattrarray(model->model, GRB_INT_ATTR_BRANCHPRIORITY, 
+			binary, numNodes, priorities);
+#if GRB_VERSION_MAJOR >= 7
+	if (!error && model->backend == SOLVER_GUROBI)
+		error = GRBsetintattrarray(model->model, GRB_INT_ATTR_VARHINTPRI, 
+			binary, numNodes, priorities);
+#endif
+	
+	//Hints, and the SOS1 slacks 1 - binary, from the binary start
+	for (j = 0; j < numNodes; j++)
+	{
+		scores[j] = hints[j];
+		starts[j] = 1.0 - hints[j];
+	}
+#if GRB_VERSION_MAJOR >= 7
+	if (!error && model->backend == SOLVER_GUROBI)
+		error = GRBsetdblattrarray(model->model, GRB_DBL_ATTR_VARHINTVAL, 
+			binary, numNodes, scores);
+#endif
+	if (!error && linkingFormulation == 1)
+		error = solverSetStart(model, binary + numNodes, numNodes, starts);
+	
+	free(priorities);
+	free(hints);
+	free(scores);
+	free(starts);
+	
+	return error;
+}
+
 
 //FUNCTION
 //Sum model error
@@ -1250,6 +2521,10 @@ int writeSummaryFile(int k, int optimstatus, double objval, double sol[])
 			i, leakDemands[i], ((leakDemands[i]/totalDemand)* 100));
 	}
 	fprintf(ptr_file, "Time To Solution:, %f, seconds\n", timePerIteration);
+	fprintf(ptr_file, "EPANET Simulations:, %d, Cache Hits:, %d, Cache Misses:, %d\n",
+		EPANETsimCounter, cacheHits, cacheMisses);
+	if (secantUpdates)
+		fprintf(ptr_file, "Secant Updates:, %d\n", secantCounter);
 	
 	fprintf(ptr_file, "\nOptimization complete\n");
 	if (optimstatus == GRB_OPTIMAL) 
@@ -1261,15 +2536,16 @@ int writeSummaryFile(int k, int optimstatus, double objval, double sol[])
 			fprintf(ptr_file, "sol[%d] =, %f, Node ID:, %s \n", 
 				(i+1), sol[i], name);
 		}
-		for (i = totalNodeCount; i < (totalNodeCount * 2); i++)
+		for (i = totalNodeCount; i < (totalNodeCount + totalRowCount); i++)
 		{		  	
 			fprintf(ptr_file, "sol[%d] =, %f, Error for sol[%d] \n",
 				(i+1), sol[i], (i + 1 - totalNodeCount));
 		}
-		for(i = (totalNodeCount * 2); i < (totalNodeCount * 3); i++)
+		for(i = (totalNodeCount + totalRowCount); 
+			i < ((totalNodeCount * 2) + totalRowCount); i++)
 		{		  	
 			fprintf(ptr_file, "sol[%d] =, %f, binary for, sol[%d] \n", 
-				(i + 1), sol[i], (i + 1 - (totalNodeCount * 2)) );
+				(i + 1), sol[i], (i + 1 - (totalNodeCount + totalRowCount)) );
 		}
 	} else if (optimstatus == GRB_INF_OR_UNBD) 
 	{
@@ -1307,11 +2583,12 @@ int writeRawResults(int k, int optimstatus, double sol[])
 	
 	if (optimstatus == GRB_OPTIMAL) 
 	{	
-		for(i = 0; i < ((totalNodeCount * 2) - 1); i++)
+		for(i = 0; i < ((totalNodeCount + totalRowCount) - 1); i++)
 		{		  	
 			fprintf(ptr_file, "  sol[%d] =, %f \n", (i+1), sol[i]);
 		}
-		for(i = ((totalNodeCount * 2) - 1); i < (totalNodeCount * 2); i++)
+		for(i = ((totalNodeCount + totalRowCount) - 1); 
+			i < (totalNodeCount + totalRowCount); i++)
 		{		  	
 			fprintf(ptr_file, "  sol[%d] =, %f", (i+1), sol[i]);
 		}
@@ -1353,11 +2630,12 @@ int writeInterimResults(int k, int count, int optimstatus, double sol[], char *m
 	
 	//if (optimstatus == GRB_OPTIMAL) 
 	//{	
-	for(i = 0; i < ((totalNodeCount * 2) - 1); i++)
+	for(i = 0; i < ((totalNodeCount + totalRowCount) - 1); i++)
 	{		  	
 		fprintf(ptr_file, "  sol[%d] =, %f \n", (i+1), sol[i]);
 	}
-	for(i = ((totalNodeCount * 2) - 1); i < (totalNodeCount * 2); i++)
+	for(i = ((totalNodeCount + totalRowCount) - 1); 
+		i < (totalNodeCount + totalRowCount); i++)
 	{		  	
 		fprintf(ptr_file, "  sol[%d] =, %f", (i+1), sol[i]);
 	}
@@ -4,8 +4,19 @@
 #include <time.h>
 #include <math.h>
 #include <sys/stat.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "L1_Matrix.h"
+#include "L1_Hydraulics.h"
+#include "L1_Solver.h"
 #include "epanet2.h" 
 #include "gurobi_c.h"
+#ifdef EPANET_2_2
+#include <pthread.h>
+#include "epanet2_2.h"
+#endif
 
 //September 10, 2013
 //L1-Approximation (L1 calculates absolute error, in this case, between
@@ -18,228 +29,288 @@
 //
 //
 int numOfLeaks = 2, iterations = 1;
+int solverBackend = SOLVER_GUROBI; //SOLVER_GUROBI or SOLVER_HIGHS, which needs -DHAVE_HIGHS and links by tight M rows without a solution pool
+int solverBenchmark = 0; //1 also solves every scenario on each built-in backend, run times and nodes to SolverBenchmark.csv
+int linkingFormulation = 0; //Links leaks to binaries by 0 bigM rows, 1 SOS1 pairs, 2 tight M rows per node, 3 indicator constraints (Gurobi 7+)
+int hypothesisCount = 0; //Best distinct leak sets taken from the solution pool into Hypotheses_<run>.csv, 0 for none
+int linkingBenchmark = 0; //1 also solves every scenario under each linking formulation, timed in LinkingBenchmark.csv
+int modelChunk = 1 << 20; //Non-zeros staged per call when the leak magnitude columns are added
+int boundTightening = 1; //1 bounds the leak magnitudes and residuals from b and A before every solve
+int sensitivityThreads = 1; //Worker threads for the sensitivity sweep (EPANET 2.2)
+int sensitivityProcesses = 1; //Forked workers for the sensitivity sweep
+int sensitivityMode = 0; //0 simulates every leak, 1 solves the linearized network, 2 uses the built-in GGA solver
+double ggaTolerance = 0.1; //Largest base case or check leak pressure difference accepted from the GGA solver
+int ggaChecks = 5; //Leaks solved by both EPANET and the GGA solver before the GGA solver is used
+int hydraulicSession = 0; //1 keeps the hydraulic solver open for the whole run, 0 reopens it per solve
+long analysisTime = -1; //Seconds into the simulation the pressures are read at, -1 for the end of EN_DURATION
+int snapshotMode = 0; //1 solves the instant at analysisTime alone, starting from the initial tank levels
+int reportPeriods = 1; //Report times stacked into the L1 rows, the last one at analysisTime
+long reportInterval = 3600; //Seconds between the stacked report times
+double sweepAccuracy = 0.0; //Looser EN_ACCURACY for the sensitivity sweep, 0 sweeps at the network's own accuracy
+double minLeakThreshold = 0.5; //Leak magnitude from which a loose column is redone at full accuracy
 double delta = 1, minLeakSize = 1.0, maxLeakSize = 10.0,
 	binaryLeakLimit = 2.0;
 char inputFile[50] = "hanoi-1.inp"; //"Net3.inp";
 char reportFile[50] = "hanoi.rpt"; //"Net3.rpt";
+char sensitivityStore[50] = "hanoi-1.sens"; //"Net3.sens"; "" disables the store
+char baseCaseStore[50] = "hanoi-1.base"; //"Net3.base"; "" disables the store
+char sensitivityLibrary[50] = ""; //"Net3.lib"; time-of-day A matrices, "" disables the library
+long librarySlice = 3600; //Seconds between the library slices
+int libraryInterpolation = 1; //1 interpolates between the two nearest slices, 0 takes the nearest one
 char directoryString[50] = "L1_MIP/";
 //
 //
 
 char globalDirName[100];
-int totalNodeCount;
-int *leakNodes;
+int totalNodeCount, totalRowCount; //Rows of A and b, every junction at each report time
+long *reportTimes, patternOffset;
+int *leakNodes, *looseColumns;
+unsigned long long storeKey;
 double totalDemand, bigM = 999999.99;
 double *baseCasePressureMatrix, *observedPressure, *coefficients, *b, *bhat,
 	*realLeakValues, *singleRunErrors, *leakDemands, *leakMagnitudes, 
-	*modelError, **largePressureMatrix, **largeA, **Ahat,  **I, 
+	*modelError, 
 	*objectiveValues; 
 	
+DenseMatrix largePressureMatrix, largeA;
+NetworkLinearization linearization;
+GGASolver ggaSolver;
+HydraulicSession session;
+NodeResults nodeResults;
 FILE *ptr_file;
 
 void initializeArrays();
+void initializeScenario();
 void populateMatricies(int);
+int addL1Model(SolverModel *, int);
+int addLeakColumns(SolverModel *, int, int);
+void populateBMatrix(int);
 void randomizeLeaks(int, int);
 void printLeakInfo(int);
+void setAnalysisTime();
+int reportPeriod(long);
 void analyzeBaseCase(int);
+int checkGGASolver(int);
 void oneLeak(int, double, int, int);
+void sensitivitySweep(int);
+int refineSupport(SolverModel *, int, int *);
+unsigned long long hashBytes(unsigned long long, const void *, size_t);
+unsigned long long networkKey(int);
+unsigned long long sensitivityStoreKey(int);
+int loadSensitivityStore(int);
+int saveSensitivityStore(int);
+int loadBaseCase(int);
+int saveBaseCase(int);
+long patternCycle();
+int buildSensitivityLibrary(int, unsigned long long);
+int loadLibrarySlices(int, unsigned long long);
+int useSensitivityLibrary(int);
+int forkedOneLeaks(int);
+#ifdef EPANET_2_2
+int threadedOneLeaks(int);
+void projectOneLeak(EN_Project, int, double, int, int, double *);
+#endif
 void nLeaks(int, int);
+int leakBounds(int, double *);
+int tightenBounds(SolverModel *, int);
+void linkBounds(int, double *);
+int updateLinkBounds(SolverModel *, int);
+int updateStart(SolverModel *, int, double *);
+int addLinkConstraints(SolverModel *, int);
+int benchmarkLinking(int, int);
+int benchmarkSolvers(int, int);
 double calculateError(int, double[]);
 int writeSummaryFile(int, int, double, double[]);
 int writeRawResults(int, int, double[]);
 int writeLeakFile(int);
+int writeHypotheses(SolverModel *, int);
 int writeErrorFile();
 int setOutputDirectory();
 
 int main(int argc, char *argv[]) 
 {
-	GRBenv *env = NULL;
-	GRBmodel *model = NULL;	
-	int  i, j, k, numNodes, storage, directoryCode;
+	SolverModel solver;
+	int  k, numNodes, storage, directoryCode;
 	double errorSum;
 	
 	//Randomize the leak locations, commented out will use the same seeding 
 	//for each run
 	//srand(time(NULL));
 	
-	i = j = k = numNodes = 0;
+	k = numNodes = 0;
 	errorSum = 0.0;
 	
 	//Open EPANET & Input file
 	ENopen(inputFile,reportFile,"");
 	
+	setAnalysisTime();
+	session.persistent = hydraulicSession;
+	
 	// Get the number of nodes
 	ENgetcount(EN_NODECOUNT, &numNodes);
 	ENgetcount(EN_TANKCOUNT, &storage);
 	totalNodeCount = numNodes - storage;
+	totalRowCount = totalNodeCount * reportPeriods;
+	openNodeResults(&nodeResults, totalNodeCount);
+	
+	storeKey = sensitivityStoreKey(totalNodeCount);
 	
 	int       error = 0;
-	double    sol[(totalNodeCount * 3)];
-	int       ind[(totalNodeCount * 3)];
-	double    val[(totalNodeCount * 3)];
-	double    obj[(totalNodeCount * 3)];
-	char      vtype[(totalNodeCount * 3)];	
-	int       optimstatus;
+	int       refined = 0;
+	double    sol[((totalNodeCount * 2) + totalRowCount)];
+	int       optimstatus = 0;
 	double    objval;
 	
-	baseCasePressureMatrix = (double *) calloc(totalNodeCount, sizeof(double));
-	observedPressure = (double *) calloc(totalNodeCount, sizeof(double));
-	coefficients = (double *) calloc((totalNodeCount * 2), sizeof(double));
+	baseCasePressureMatrix = (double *) calloc(totalRowCount, sizeof(double));
+	observedPressure = (double *) calloc(totalRowCount, sizeof(double));
+	coefficients = (double *) calloc((totalNodeCount + totalRowCount), 
+		sizeof(double));
 	realLeakValues = (double *) calloc(totalNodeCount, sizeof(double));
 	singleRunErrors = (double *) calloc(totalNodeCount, sizeof(double));
-	b = (double *) calloc(totalNodeCount, sizeof(double));
-	bhat = (double *) calloc((totalNodeCount * 2), sizeof(double));
+	b = (double *) calloc(totalRowCount, sizeof(double));
+	bhat = (double *) calloc((totalRowCount * 2), sizeof(double));
 	leakDemands = (double *) calloc(numOfLeaks, sizeof(double));
 	leakNodes = (int *) calloc(numOfLeaks,sizeof(int));
+	looseColumns = (int *) calloc(totalNodeCount, sizeof(int));
 	leakMagnitudes = (double *) calloc(numOfLeaks,sizeof(double));
 	modelError = (double *) calloc(iterations, sizeof(double));
 	objectiveValues = (double *) calloc(iterations, sizeof(double));
 	
-	largePressureMatrix = (double **) malloc(totalNodeCount * sizeof(double *));
-	for(i = 0; i < totalNodeCount; i++)
-		largePressureMatrix[i] = malloc(totalNodeCount * sizeof(double));
-	
-	largeA = (double **) malloc(totalNodeCount * sizeof(double *));
-	for(i = 0; i < totalNodeCount; i++)
-		largeA[i] = malloc(totalNodeCount * sizeof(double));
-	
-	I = (double **) malloc(totalNodeCount * sizeof(double *));
-	for(i = 0; i < totalNodeCount; i++)
-		I[i] = malloc(totalNodeCount * sizeof(double));
+	//The pressure matrix is a shared mapping when forked workers fill it
+	if (sensitivityProcesses < 2 || createMatrix(&largePressureMatrix, 
+		totalRowCount, totalNodeCount, 1) != 0)
+		createMatrix(&largePressureMatrix, totalRowCount, totalNodeCount, 0);
 	
-	Ahat = (double **) malloc( (totalNodeCount * 2) * sizeof(double *) );
-	for(i = 0; i < (totalNodeCount * 2); i++)
-		Ahat[i] = malloc( (totalNodeCount * 2) * sizeof(double) );
+	//A is formed in place over the pressures. A column of A only depends on
+	//	the same column of pressures, which is always simulated again before
+	//	that column is formed anew, so the two are never needed at once
+	shareMatrix(&largeA, &largePressureMatrix);
 	
 	/* Create environment */
- 	error = GRBloadenv(&env, "L1_MIP.log");
+ 	error = openSolver(&solver, solverBackend, "L1_MIP.log", "L1MIP");
  	if (error) goto QUIT;
  	
  	directoryCode = setOutputDirectory();
 	
+	//The unperturbed network and delta are the same for every scenario, so 
+	//	the base case and the A matrix are only built once
+	initializeArrays();
+	
+	//A time-of-day library stands in for the base case and the sweep
+	if (useSensitivityLibrary(totalNodeCount) != 0)
+	{
+		//The linearized and built-in solvers need the toolkit to hold the 
+		//	solved base case, otherwise it can come from the store
+		if (sensitivityMode != 0 || loadBaseCase(totalNodeCount) != 0)
+		{
+			analyzeBaseCase(totalNodeCount);
+			saveBaseCase(totalNodeCount);
+		}
+		
+		populateMatricies(totalNodeCount);
+	}
+	
 	//Create observation	
 	for (k = 0; k < iterations; k++)
 	{		
-		initializeArrays();
+		initializeScenario();
 		
 		randomizeLeaks(totalNodeCount, numOfLeaks);
 		
-		analyzeBaseCase(totalNodeCount);
-		
 		nLeaks(numOfLeaks, totalNodeCount);
 		
 		printLeakInfo(numOfLeaks);
 		
-		populateMatricies(totalNodeCount);
-		
-		// Create an empty model 		
- 		error = GRBnewmodel(env, &model, "L1MIP", 0, NULL, NULL, NULL, NULL, 
- 			NULL);
- 		if (error) goto QUIT;
- 		 	
- 		// Add variables 
- 		for (i = 0; i < (totalNodeCount * 2); i++)
- 		{
- 			obj[i] = coefficients[i]; 			
- 			vtype[i] = GRB_CONTINUOUS; 			
- 		}
- 		
- 		for (i = (totalNodeCount * 2); i < (totalNodeCount * 3); i++)
- 		{
- 			obj[i] = 0.0;
- 			vtype[i] = GRB_BINARY;
- 		}
- 		 				
-		error = GRBaddvars(model, (totalNodeCount * 3), 0, NULL, NULL, NULL, obj,
-			NULL, NULL, vtype, NULL);
-		if (error) goto QUIT;
-		
-		// Integrate new variables		
-		error = GRBupdatemodel(model);
-		if (error) goto QUIT;
-		
-		// First constraint: Ax <= b						
-		for (i = 0; i < (totalNodeCount); i++)
-		{		
-			for (j = 0; j < (totalNodeCount); j++)
-			{
-				ind[j] = j;
-				val[j] = Ahat[i][j];			
-			}								
-			ind[totalNodeCount] = j + i;
-			val[totalNodeCount] = Ahat[i][j+i];
-			error = GRBaddconstr(model, (totalNodeCount + 1), ind, val, 
-				GRB_LESS_EQUAL, bhat[i],NULL);			
-			if (error) goto QUIT;
-		}
+		populateBMatrix(totalNodeCount);
 		
-		for (i = totalNodeCount; i < (totalNodeCount * 2); i++)
+		//The model is built for the first scenario only, after that just the 
+		//	observations on the right hand side change and each solve is 
+		//	warm started from the previous basis
+		if (solver.cols == 0)
 		{
+			error = addL1Model(&solver, totalNodeCount);
+			if (error) goto QUIT;
 			
-				for (j = 0; j < (totalNodeCount); j++)
-				{
-					ind[j] = j;
-					val[j] = Ahat[i][j];			
-				}								
-				ind[totalNodeCount] = j + (i-totalNodeCount);
-				val[totalNodeCount] = Ahat[i][j+(i-totalNodeCount)];
-				error = GRBaddconstr(model, (totalNodeCount + 1), ind, val, 
-					GRB_LESS_EQUAL, bhat[i],NULL);			
+			error = solverDualSimplex(&solver);
+			if (error) goto QUIT;
+			
+			//Hypotheses come from Gurobi's solution pool
+			if (hypothesisCount > 0 && solver.backend != SOLVER_GUROBI)
+			{
+				printf("\n%s has no solution pool, no hypotheses written\n", 
+					solverName(&solver));
+				hypothesisCount = 0;
+			}
+			
+#if GRB_VERSION_MAJOR > 6 || (GRB_VERSION_MAJOR == 6 && GRB_VERSION_MINOR >= 5)
+			//Search the pool systematically for the best solutions, twice as
+			//	many as hypotheses since some repeat a leak set
+			if (hypothesisCount > 0)
+			{
+				error = GRBsetintparam(GRBgetenv(solver.model), 
+					GRB_INT_PAR_POOLSOLUTIONS, hypothesisCount * 2);
 				if (error) goto QUIT;
+				
+				error = GRBsetintparam(GRBgetenv(solver.model), 
+					GRB_INT_PAR_POOLSEARCHMODE, 2);
+				if (error) goto QUIT;
+			}
+#endif
 		}
-		/*
-		// First constraint: Ax <= b						
-		for (i = 0; i < (totalNodeCount * 2); i++)
+		else
 		{
-			for (j = 0; j < (totalNodeCount * 2); j++)
-			{
-				ind[j] = j;
-				val[j] = Ahat[i][j];			
-			}								
-			error = GRBaddconstr(model, (totalNodeCount * 2), ind, val, 
-				GRB_LESS_EQUAL, bhat[i],NULL);			
+			error = solverSetRHS(&solver, 0, (totalRowCount * 2), bhat);
 			if (error) goto QUIT;
-		}
-		*/
-		//Leak magnitude - (binary * bigM) <= 0
-		for (i = (totalNodeCount * 2); i < (totalNodeCount * 3); i++)
-		{		
-			ind[0] = (i - (totalNodeCount * 2)); 	ind[1] = i; 
-			val[0] = 1.0; 		val[1] = -bigM ;
-									
-			error = GRBaddconstr(model, 2, ind, val, GRB_LESS_EQUAL,0.0,NULL);
+			
+			error = updateLinkBounds(&solver, totalNodeCount);
+			if (error) goto QUIT;
+			
+			error = tightenBounds(&solver, totalNodeCount);
 			if (error) goto QUIT;
+			
+			//Start from the previous leak estimate
+			if (optimstatus == GRB_OPTIMAL)
+			{
+				error = updateStart(&solver, totalNodeCount, sol);
+				if (error) goto QUIT;
+			}
 		}
 		
-		// Limit sum of binaries to number of leaks searching for...		
-		for (i = (totalNodeCount * 2); i < (totalNodeCount * 3); i++)
-		{		
-			ind[i-(totalNodeCount * 2)] = i;
-			val[i-(totalNodeCount * 2)] = 1.0;
-		}								
-		error = GRBaddconstr(model, totalNodeCount, ind, val, GRB_LESS_EQUAL,
-			binaryLeakLimit,NULL);
-		if (error) goto QUIT;	
-
-		error = GRBoptimize(model);
+		error = solverOptimize(&solver);
 		if (error) goto QUIT;
 		
-		// Write model to 'L1Approx.lp'		
-		error = GRBwrite(model, "L1_MIP.lp");
+		//Columns of a loose sweep that the solution uses are redone at full 
+		//	accuracy and the model solved again, until it uses none
+		error = refineSupport(&solver, totalNodeCount, &refined);
 		if (error) goto QUIT;
+		while (refined > 0)
+		{
+			error = updateLinkBounds(&solver, totalNodeCount);
+			if (error) goto QUIT;
+			
+			error = tightenBounds(&solver, totalNodeCount);
+			if (error) goto QUIT;
+			
+			error = solverOptimize(&solver);
+			if (error) goto QUIT;
+			
+			error = refineSupport(&solver, totalNodeCount, &refined);
+			if (error) goto QUIT;
+		}
 		
-		error = GRBwrite(model, "L1_MIP.sol");
+		// Write model to 'L1Approx.lp'		
+		error = solverWrite(&solver, "L1_MIP.lp");
 		if (error) goto QUIT;
 		
-		// Capture solution information		
-		error = GRBgetintattr(model, GRB_INT_ATTR_STATUS, &optimstatus);
+		error = solverWrite(&solver, "L1_MIP.sol");
 		if (error) goto QUIT;
 		
-		error = GRBgetdblattr(model, GRB_DBL_ATTR_OBJVAL, &objval);
-		if (error) goto QUIT;
+		// Capture solution information		
+		optimstatus = solver.status;
+		objval = solver.objval;
 		
-		error = GRBgetdblattrarray(model, GRB_DBL_ATTR_X, 0, 
-			(totalNodeCount * 3), sol);
+		error = solverGetX(&solver, 0, 
+			((totalNodeCount * 2) + totalRowCount), sol);
 		if (error) goto QUIT;
 		
 		printf("\nOptimization complete\n");
@@ -266,19 +337,26 @@ int main(int argc, char *argv[])
 		objectiveValues[k] = objval;
 		modelError[k] = calculateError(totalNodeCount, sol);		
 		
+		if (linkingBenchmark)
+			benchmarkLinking(totalNodeCount, k);
+		if (solverBenchmark)
+			benchmarkSolvers(totalNodeCount, k);
+		
 		writeSummaryFile(k, optimstatus, objval, sol);
 		writeRawResults(k, optimstatus, sol);
 		writeLeakFile(k);
-		
-		/* Free model */
-		GRBfreemodel(model);		
+		if (hypothesisCount > 0)
+			writeHypotheses(&solver, k);
 	}
 	
+	closeSession(&session);
+	closeNodeResults(&nodeResults);
 	ENclose();
 	
 	//writeErrorFile();
 	
 	free(leakNodes);
+	free(looseColumns);
 	free(leakMagnitudes);
 	free(leakDemands);
 	free(modelError);
@@ -291,21 +369,12 @@ int main(int argc, char *argv[])
 	free(realLeakValues);
 	free(singleRunErrors);
 	
-	for(i = 0; i < totalNodeCount; i++)
-		free((void *)largePressureMatrix[i]);
-	free((void *)largePressureMatrix);
-	
-	for(i = 0; i < totalNodeCount; i++)
-		free((void *)largeA[i]);
-	free((void *)largeA);
-	
-	for(i = 0; i < totalNodeCount; i++)
-		free((void *)I[i]);
-	free((void *)I);
+	freeMatrix(&largePressureMatrix);
+	freeMatrix(&largeA);
+	freeLinearization(&linearization);
+	closeGGASolver(&ggaSolver);
+	free(reportTimes);
 	
-	for(i = 0; i < (totalNodeCount * 2); i++)
-		free((void *)Ahat[i]);
-	free((void *)Ahat);
 	
 	
 		QUIT:
@@ -313,17 +382,13 @@ int main(int argc, char *argv[])
 		/* Error reporting */
 		
 		if (error) {
-		  printf("ERROR: %s\n", GRBgeterrormsg(env));
+		  printf("ERROR: %s\n", solverError(&solver));
 		  exit(1);
 		}
 		
-		/* Free model */
+		/* Free model and environment */
 		
-		GRBfreemodel(model);
-		
-		/* Free environment */
-		
-		GRBfreeenv(env);
+		closeSolver(&solver);
 			
 	return 0;
 }
@@ -338,149 +403,150 @@ void initializeArrays()
 	//Array initialization	
 	for (i = 0; i < totalNodeCount; i++)
 	{
-		observedPressure[i] = 0;
-		baseCasePressureMatrix[i] = 0;
-		b[i] = 0;
 		realLeakValues[i] = 0.0;
 		singleRunErrors[i] = 0.0;	
 	}
 	
-	for (i = 0; i < (totalNodeCount * 2); i++)
+	for (i = 0; i < totalRowCount; i++)
 	{
-		bhat[i] = 0;		
+		observedPressure[i] = 0;
+		baseCasePressureMatrix[i] = 0;
+		b[i] = 0;
 	}
 	
-	for (i = 0; i < (totalNodeCount * 2); i++)
+	for (i = 0; i < (totalRowCount * 2); i++)
 	{
-		coefficients[i] = 0;		
+		bhat[i] = 0;		
 	}
 	
-	for (i = 0; i < totalNodeCount; i++)
+	for (i = 0; i < (totalNodeCount + totalRowCount); i++)
 	{
-		for (j = 0; j < totalNodeCount; j++)
-		{
-			largePressureMatrix[i][j] = 0;
-			largeA[i][j] = 0;		
-		}
+		coefficients[i] = 0;		
 	}
 	
-	for (i = 0; i < (totalNodeCount * 2); i++)
-	{
-		for (j = 0; j < (totalNodeCount * 2); j++)
-		{
-			Ahat[i][j] = 0;		
-		}
-	}
+	clearMatrix(&largePressureMatrix);
+	clearMatrix(&largeA);
 	
+	//Create c-transpose
 	for (i = 0; i < totalNodeCount; i++)
 	{
-		for (j = 0; j < totalNodeCount; j++)
-		{
-			I[i][j] = 0;
-		}
+		coefficients[i] = 0.0;
 	}	
-
-	//Create Identity Matrix
-	for(i = 0; i < totalNodeCount; i++)
+	for (i = totalNodeCount; i < (totalNodeCount + totalRowCount); i++)
 	{
-		for (j = 0; j < totalNodeCount; j++)
-		{
-			if (i==j)
-				I[i][j] = 1;
-		}
+		coefficients[i] = 1.0;
 	}
 	
-	//Create c-transpose
+}
+
+//FUNCTION
+//Reset the arrays that belong to a single leak scenario
+void initializeScenario()
+{
+	int i;
+	i = 0;
+	
 	for (i = 0; i < totalNodeCount; i++)
 	{
-		coefficients[i] = 0.0;
-	}	
-	for (i = totalNodeCount; i < (totalNodeCount * 2); i++)
+		realLeakValues[i] = 0.0;
+		singleRunErrors[i] = 0.0;	
+	}
+	
+	for (i = 0; i < totalRowCount; i++)
 	{
-		coefficients[i] = 1.0;
+		observedPressure[i] = 0;
+		b[i] = 0;
 	}
 	
+	for (i = 0; i < (totalRowCount * 2); i++)
+	{
+		bhat[i] = 0;		
+	}
 }
 
 //FUNCTION
-//Populate array values for the L1 Approximation
-//Also calls single leak simulations for each node in the network
-void populateMatricies(int numNodes)
+//Populate the b and b-hat arrays from the observed pressures of the current
+//	scenario, one row for every junction at each report time
+void populateBMatrix(int numNodes)
 {
-	int i, j, temp;
+	int i, rows, temp;
 	
-	i = j = 0;
+	i = 0;
+	rows = numNodes * reportPeriods;
 	
 	//Update b matrix
-	for (i = 0; i < numNodes; i++)
+	for (i = 0; i < rows; i++)
 	{
 		b[i] = (baseCasePressureMatrix[i] - observedPressure[i]);	
 		//printf("b[%d] = %f\n",i,b[i]);
 	}
 	
 	//Create b-hat
-	for (i = 0; i < numNodes; i++)
+	for (i = 0; i < rows; i++)
 	{
 		bhat[i] = b[i];
 	}
-	for (i = numNodes; i < (numNodes * 2); i++)
+	for (i = rows; i < (rows * 2); i++)
 	{
-		bhat[i] = -b[i-numNodes];
+		bhat[i] = -b[i-rows];
 	}
 	
-	
-	for(i = 1; i <= numNodes; i++)
-	{		
-		oneLeak(i, delta, numNodes, i-1);		
+	//Keep track of the emitter coefficient at every network node (most should
+	//	be zero)
+	for (i = 0; i < numOfLeaks; i++)
+	{
+		temp = (leakNodes[i]-1);		
+		realLeakValues[temp] = leakMagnitudes[i];
 	}
+}
+
+//FUNCTION
+//Populate the A matrix for the L1 Approximation
+//Also calls single leak simulations for each node in the network
+void populateMatricies(int numNodes)
+{
+	int i, j;
+	double *pressures, *column;
 	
-	//Update A matrix		
-	for(i = 0; i < numNodes; i++)
-	{		
-		for(j = 0; j < numNodes; j++)
-		{
-			largeA[i][j] = (baseCasePressureMatrix[i] - 
-				largePressureMatrix[i][j]) / delta;			
-		}			
-	}	
+	float accuracy;
 	
-	//Create A-hat
-	for(i = 0; i < numNodes; i++)
-	{
-		for(j = 0; j < numNodes; j++)
-		{
-			Ahat[i][j] =  largeA[i][j];
-		}
-	}
-	for(i = numNodes; i < (numNodes * 2); i++)
-	{
-		for(j = 0; j < numNodes; j++)
-		{
-			Ahat[i][j] = -largeA[i-numNodes][j];
-		}
-	}
-	for(i = 0; i < numNodes; i++)
+	i = j = 0;
+	
+	if (loadSensitivityStore(numNodes) != 0)
 	{
-		for(j = numNodes; j < (numNodes * 2); j++)
+		//A loose sweep is not stored, refineSupport redoes the columns that 
+		//	matter as the scenarios are solved
+		if (sweepAccuracy > 0.0 && sensitivityMode == 0)
 		{
-			Ahat[i][j] = -I[i][j-numNodes];
+			ENgetoption(EN_ACCURACY, &accuracy);
+			ENsetoption(EN_ACCURACY, sweepAccuracy);
+			sensitivitySweep(numNodes);
+			ENsetoption(EN_ACCURACY, accuracy);
+			
+			for (j = 0; j < numNodes; j++)
+			{
+				looseColumns[j] = 1;
+			}
 		}
-	}
-	for(i = numNodes; i < (numNodes * 2); i++)
-	{
-		for(j = numNodes; j < (numNodes * 2); j++)
+		else
 		{
-			Ahat[i][j] = -I[i-numNodes][j-numNodes];
+			sensitivitySweep(numNodes);
+			saveSensitivityStore(numNodes);
 		}
 	}
 	
-	//Keep track of the emitter coefficient at every network node (most should
-	//	be zero)
-	for (i = 0; i < numOfLeaks; i++)
-	{
-		temp = (leakNodes[i]-1);		
-		realLeakValues[temp] = leakMagnitudes[i];
-	}
+	//Update A matrix, a column at a time, over the pressures it is formed 
+	//	from
+	for(j = 0; j < numNodes; j++)
+	{		
+		pressures = MATRIX_COLUMN(largePressureMatrix, j);
+		column = MATRIX_COLUMN(largeA, j);
+		for(i = 0; i < largeA.rows; i++)
+		{
+			column[i] = (baseCasePressureMatrix[i] - pressures[i]) / delta;			
+		}			
+	}	
+
 }
 
 void randomizeLeaks(int numNodes, int numOfLeaks)
@@ -554,6 +620,226 @@ void randomizeLeaks(int numNodes, int numOfLeaks)
 }
 
 
+//FUNCTION
+//Add a leak magnitude column for every node, A over -A, plus a 1 in row 
+//	linkRow + j unless linkRow is negative. The columns are read straight 
+//	from largeA and go in chunks of at most modelChunk non-zeros, so the 
+//	staging block stays small and its int offsets cannot overflow on large 
+//	networks. Zero coefficients are left out
+int addLeakColumns(SolverModel *model, int numNodes, int linkRow)
+{
+	int i, j, first, nz, capacity, numRows, error;
+	int *vbeg, *vind;
+	double *vval, *column;
+	
+	numRows = largeA.rows;
+	capacity = numRows * 2 + 1;
+	if (capacity < modelChunk)
+		capacity = modelChunk;
+	
+	vbeg = (int *) malloc(numNodes * sizeof(int));
+	vind = (int *) malloc(capacity * sizeof(int));
+	vval = (double *) malloc(capacity * sizeof(double));
+	
+	error = first = nz = 0;
+	for (j = 0; j <= numNodes && !error; j++)
+	{
+		//Load the chunk once the next column might not fit, and at the end
+		if (j == numNodes || nz + numRows * 2 + 1 > capacity)
+		{
+			if (j > first)
+				error = solverAddColumns(model, j - first, nz, vbeg, vind, 
+					vval, coefficients + first, NULL, NULL);
+			first = j;
+			nz = 0;
+		}
+		if (j == numNodes)
+			break;
+		
+		column = MATRIX_COLUMN(largeA, j);
+		vbeg[j - first] = nz;
+		for (i = 0; i < numRows; i++)
+		{
+			if (column[i] == 0.0)
+				continue;
+			vind[nz] = i;
+			vval[nz] = column[i];
+			nz++;
+		}
+		for (i = 0; i < numRows; i++)
+		{
+			if (column[i] == 0.0)
+				continue;
+			vind[nz] = numRows + i;
+			vval[nz] = -column[i];
+			nz++;
+		}
+		if (linkRow >= 0)
+		{
+			vind[nz] = linkRow + j;
+			vval[nz] = 1.0;
+			nz++;
+		}
+	}
+	
+	free(vbeg);
+	free(vind);
+	free(vval);
+	
+	return error;
+}
+
+//FUNCTION
+//Add the L1 variables and rows, A x - e <= b and -A x - e <= -b, to an empty 
+//	model. The rows go in first without coefficients, then the leak 
+//	magnitudes with addLeakColumns and the remaining variables with one 
+//	solverAddColumns call, both in compressed sparse column form. The 
+//	linking rows of linkingFormulation and the leak cardinality row are 
+//	part of the same block. With stacked report times A has a row, and e 
+//	an element, for every junction at each report time
+int addL1Model(SolverModel *model, int numNodes)
+{
+	int i, rows, vars, nz, error, numRows, linkRow, binary, bigMRows;
+	int *vbeg, *vind;
+	double *vval, *rhs, *obj, *bounds;
+	char *sense, *vtype;
+	
+#if GRB_VERSION_MAJOR < 7
+	if (linkingFormulation == 3)
+	{
+		printf("\nIndicator constraints need Gurobi 7, using tight M rows\n");
+		linkingFormulation = 2;
+	}
+#endif
+	if (model->backend != SOLVER_GUROBI && (linkingFormulation == 1 || 
+		linkingFormulation == 3))
+	{
+		printf("\n%s has no SOS1 or indicator constraints, using tight M "
+			"rows\n", solverName(model));
+		linkingFormulation = 2;
+	}
+	
+	//Columns after the leak magnitudes are staged from 0, the binaries 
+	//	follow the residuals
+	numRows = largeA.rows;
+	linkRow = numRows * 2;
+	binary = numRows;
+	rows = linkRow + numNodes + 1;
+	vars = numRows + numNodes;
+	nz = (numRows * 2) + (numNodes * 3);
+	
+	//SOS1 pairs each leak magnitude with a slack for 1 - binary
+	if (linkingFormulation == 1)
+		vars += numNodes;
+	bigMRows = (linkingFormulation == 0 || linkingFormulation == 2);
+	
+	rhs = (double *) malloc(rows * sizeof(double));
+	sense = (char *) malloc(rows * sizeof(char));
+	vbeg = (int *) malloc(vars * sizeof(int));
+	obj = (double *) malloc(vars * sizeof(double));
+	vtype = (char *) malloc(vars * sizeof(char));
+	vind = (int *) malloc(nz * sizeof(int));
+	vval = (double *) malloc(nz * sizeof(double));
+	
+	for (i = 0; i < rows; i++)
+	{
+		sense[i] = GRB_LESS_EQUAL;
+		rhs[i] = 0.0;
+	}
+	for (i = 0; i < (numRows * 2); i++)
+	{
+		rhs[i] = bhat[i];
+	}
+	
+	// Limit sum of binaries to number of leaks searching for...
+	rhs[linkRow + numNodes] = binaryLeakLimit;
+	
+	//Binary plus slack is one for the SOS1 pairs
+	for (i = 0; linkingFormulation == 1 && i < numNodes; i++)
+	{
+		sense[linkRow + i] = GRB_EQUAL;
+		rhs[linkRow + i] = 1.0;
+	}
+	
+	error = solverAddRows(model, rows, sense, rhs);
+	
+	//Leak magnitudes, with a 1 in their linking row for the M rows
+	if (!error)
+		error = addLeakColumns(model, numNodes, bigMRows ? linkRow : -1);
+	
+	//Residuals
+	nz = 0;
+	for (i = 0; i < numRows; i++)
+	{
+		vbeg[i] = nz;
+		vind[nz] = i;
+		vval[nz] = -1.0;
+		nz++;
+		vind[nz] = numRows + i;
+		vval[nz] = -1.0;
+		nz++;
+		obj[i] = coefficients[numNodes + i];
+		vtype[i] = GRB_CONTINUOUS;
+	}
+	
+	bounds = (double *) malloc(numNodes * sizeof(double));
+	for (i = 0; i < numNodes; i++)
+	{
+		bounds[i] = bigM;
+	}
+	if (linkingFormulation == 2)
+		linkBounds(numNodes, bounds);
+	
+	//Leak magnitude - (binary * M) <= 0, or binary + slack = 1 for SOS1, 
+	//	and the cardinality row. Indicator constraints leave the linking 
+	//	rows empty
+	for (i = 0; i < numNodes; i++)
+	{
+		vbeg[binary + i] = nz;
+		if (linkingFormulation != 3)
+		{
+			vind[nz] = linkRow + i;
+			vval[nz] = bigMRows ? -bounds[i] : 1.0;
+			nz++;
+		}
+		vind[nz] = linkRow + numNodes;
+		vval[nz] = 1.0;
+		nz++;
+		obj[binary + i] = 0.0;
+		vtype[binary + i] = GRB_BINARY;
+	}
+	
+	for (i = 0; linkingFormulation == 1 && i < numNodes; i++)
+	{
+		vbeg[binary + numNodes + i] = nz;
+		vind[nz] = linkRow + i;
+		vval[nz] = 1.0;
+		nz++;
+		obj[binary + numNodes + i] = 0.0;
+		vtype[binary + numNodes + i] = GRB_CONTINUOUS;
+	}
+	
+	free(bounds);
+	
+	if (!error)
+		error = solverAddColumns(model, vars, nz, vbeg, vind, vval, obj, NULL, 
+			vtype);
+	if (!error)
+		error = addLinkConstraints(model, numNodes);
+	if (!error)
+		error = tightenBounds(model, numNodes);
+	
+	free(rhs);
+	free(sense);
+	free(vbeg);
+	free(obj);
+	free(vtype);
+	free(vind);
+	free(vval);
+	
+	return error;
+}
+
 //FUNCTION
 //Print the location and magnitude of leaks
 void printLeakInfo(int numOfLeaks)
@@ -570,82 +856,1482 @@ void printLeakInfo(int numOfLeaks)
 	}
 }
 
+//FUNCTION
+//Resolve analysisTime and end the simulation there, so every hydraulic run
+//	stops at the instant its pressures are read instead of stepping through
+//	the rest of EN_DURATION. A snapshot shifts the patterns to analysisTime
+//	and solves that single period. Also lays out the stacked report times, 
+//	reportInterval apart and ending at analysisTime
+void setAnalysisTime()
+{
+	long duration, patternStart;
+	int k;
+	
+	ENgettimeparam(EN_DURATION, &duration);
+	ENgettimeparam(EN_PATTERNSTART, &patternStart);
+	
+	if (analysisTime < 0 || analysisTime > duration)
+		analysisTime = duration;
+	
+	if (snapshotMode)
+	{
+		ENsettimeparam(EN_PATTERNSTART, patternStart + analysisTime);
+		patternOffset = analysisTime;
+		analysisTime = 0;
+	}
+	
+	ENsettimeparam(EN_DURATION, analysisTime);
+	
+	//Report times before the start of the simulation are dropped
+	if (reportPeriods < 1 || reportInterval <= 0)
+		reportPeriods = 1;
+	if ((long)(reportPeriods - 1) * reportInterval > analysisTime)
+		reportPeriods = (int)(analysisTime / reportInterval) + 1;
+	
+	reportTimes = (long *) calloc(reportPeriods, sizeof(long));
+	for (k = 0; k < reportPeriods; k++)
+	{
+		reportTimes[k] = analysisTime - 
+			(long)(reportPeriods - 1 - k) * reportInterval;
+	}
+	
+	if (reportPeriods > 1)
+	{
+		//The toolkit cuts its hydraulic steps at every reporting time, so 
+		//	each report time is solved exactly
+		ENsettimeparam(EN_REPORTSTART, reportTimes[0]);
+		ENsettimeparam(EN_REPORTSTEP, reportInterval);
+		
+		//The linearized network and the built-in solver model one instant
+		if (sensitivityMode != 0)
+		{
+			printf("\nStacked report times need simulation, simulating every leak\n");
+			sensitivityMode = 0;
+		}
+	}
+}
+
+//FUNCTION
+//Period of report time t, -1 if pressures are not reported at t
+int reportPeriod(long t)
+{
+	int k;
+	
+	for (k = 0; k < reportPeriods; k++)
+	{
+		if (reportTimes[k] == t)
+			return k;
+	}
+	
+	return -1;
+}
+
 //FUNCTION
 //Runs the hydraulic analysis on the base case scenario
 void analyzeBaseCase(int nodeCount)
 {		
 	long t, tstep, hydraulicTimeStep, duration;
-	float pressure;
-	int i;	
+	double *pressures;
+	int i, period, formula;	
 	//char name[20];
 	
 	i = 0;
-	pressure = 0.0;
 	
 	ENgettimeparam( EN_HYDSTEP, &hydraulicTimeStep );
 	ENgettimeparam( EN_DURATION, &duration );
 	
 	//Open and initialize the hydraulic solver
-	ENopenH();  
-	ENinitH(0);  
+	beginSolve(&session);
 
 	//Run the hydraulic solver one hydraulic time step at a time
 	do 
 	{  		
 		ENrunH(&t);		
-		// Retrieve hydraulic results for time t
-		for (i=1; i <= nodeCount; i++)
+		//Later solves start from the flows of the first time step
+		if (!session.baseFlows)
+			saveBaseFlows(&session);
+		// Retrieve hydraulic results at the report times
+		period = reportPeriod(t);
+		if (period >= 0)
 		{
-			ENgetnodevalue(i, EN_PRESSURE, &pressure);
-			//ENgetnodeid(i, name);
-			baseCasePressureMatrix[i-1] = pressure;		
+			pressures = readNodeResults(&nodeResults, EN_PRESSURE);
+			for (i = 0; i < nodeCount; i++)
+			{
+				baseCasePressureMatrix[period * nodeCount + i] = pressures[i];
+			}
 		}		
 		ENnextH(&tstep);  	
 	} while (tstep > 0); 
 	
-	//Close the hydraulic solver
-	ENcloseH();  
-}
-
-//FUNCTION
-//Place a single leak at the index location in the network and run hydraulic analysis
-//Determines how many pressure violations occur in the network by leak location
-void oneLeak(int index, double emitterCoeff, int nodeCount, int columnNumber) 
-{	
-	int i;
-	long t, tstep, hydraulicTimeStep;
-	float pressure;
+	//Close the hydraulic solver, unless the session keeps it
+	endSolve(&session);
+	
+	//Both need the head loss formula, which the 2.0 toolkit does not 
+	//	report, so it is read from the input file
+	formula = (sensitivityMode != 0) ? headlossFormula(inputFile) : -1;
+	if (sensitivityMode != 0 && formula < 0)
+	{
+		printf("\nHead loss formula of %s unknown, simulating every leak\n", 
+			inputFile);
+		sensitivityMode = 0;
+	}
+	
+	//Linearize about the base case while its heads and flows are current
+	if (sensitivityMode == 1 && 
+		linearizeNetwork(&linearization, nodeCount, formula) != 0)
+	{
+		printf("\nNetwork could not be linearized, simulating every leak\n");
+		sensitivityMode = 0;
+	}
+	
+	//The built-in solver has to reproduce these pressures before it is used
+	if (sensitivityMode == 2 && 
+		openGGASolver(&ggaSolver, nodeCount, ggaTolerance, formula) != 0)
+	{
+		printf("\nBuilt-in solver does not match the base case, simulating every leak\n");
+		sensitivityMode = 0;
+	}
+	
+	//It also has to reproduce a few simulated leaks
+	if (sensitivityMode == 2 && checkGGASolver(nodeCount) != 0)
+	{
+		printf("\nBuilt-in solver does not match the check leaks, simulating every leak\n");
+		closeGGASolver(&ggaSolver);
+		sensitivityMode = 0;
+	}
+}
+
+//FUNCTION
+//Solve ggaChecks leaks spread evenly over the junctions with both EPANET and
+//	the built-in solver. Pump curves are refit through the base operating 
+//	point, so reproducing the base case alone does not show the perturbed 
+//	solves are right. The columns simulated here are redone by the sweep.
+//	Returns non-zero if a pressure differs by more than ggaTolerance
+int checkGGASolver(int nodeCount)
+{
+	int c, i, j, checks;
+	double worst, *built, *simulated;
+	
+	checks = (ggaChecks < nodeCount) ? ggaChecks : nodeCount;
+	built = (double *) malloc(nodeCount * sizeof(double));
+	worst = 0.0;
+	
+	for (c = 0; c < checks; c++)
+	{
+		j = (int)((long)c * nodeCount / checks);
+		
+		//A leak the built-in solver does not converge is simulated anyway
+		if (ggaOneLeak(&ggaSolver, j, delta, built) != 0)
+			continue;
+		
+		oneLeak(j + 1, delta, nodeCount, j);
+		simulated = MATRIX_COLUMN(largePressureMatrix, j);
+		for (i = 0; i < nodeCount; i++)
+		{
+			if (fabs(simulated[i] - built[i]) > worst)
+				worst = fabs(simulated[i] - built[i]);
+		}
+	}
+	
+	printf("\nBuilt-in solver checked against EPANET on %d leaks, largest "
+		"pressure difference %f\n", checks, worst);
+	
+	free(built);
+	
+	return (worst > ggaTolerance);
+}
+
+//FUNCTION
+//Place a single leak at the index location in the network and run hydraulic analysis
+//Determines how many pressure violations occur in the network by leak location
+void oneLeak(int index, double emitterCoeff, int nodeCount, int columnNumber) 
+{	
+	int period;
+	long t, tstep;
+	double *pressures;
+	
+	//Create the leak
+	ENsetnodevalue(index, EN_EMITTER, emitterCoeff);
+	
+	beginSolve(&session);
+
+	//Run the hydraulic analysis
+	do {  	
+		ENrunH(&t);		
+		period = reportPeriod(t);
+		if (period >= 0)
+		{
+			pressures = readNodeResults(&nodeResults, EN_PRESSURE);
+			memcpy(MATRIX_COLUMN(largePressureMatrix, columnNumber) + 
+				period * nodeCount, pressures, nodeCount * sizeof(double));
+		}
+		ENnextH(&tstep); 
+	} while (tstep > 0); 
+	
+	//Close the hydraulic solver, unless the session keeps it
+	endSolve(&session);
+	
+	//"Fix" the leak
+	ENsetnodevalue(index, EN_EMITTER, 0.0);
+}
+
+//FUNCTION
+//Run the single leak simulation for every node, filling one column of 
+//	largePressureMatrix per node. Worker threads are used when built against
+//	EPANET 2.2 and sensitivityThreads > 1, forked worker processes when 
+//	sensitivityProcesses > 1, otherwise the global project is used
+void sensitivitySweep(int numNodes)
+{
+	int i;
 	
 	i = 0;
-	pressure = 0;
 	
-	ENgettimeparam(EN_HYDSTEP, &hydraulicTimeStep);
+	if (sensitivityMode == 1)
+	{
+		for (i = 0; i < numNodes; i++)
+		{
+			linearizedPressures(&linearization, i, delta, 
+				MATRIX_COLUMN(largePressureMatrix, i));
+		}
+		return;
+	}
+	
+	//Columns the built-in solver cannot converge are simulated instead
+	if (sensitivityMode == 2)
+	{
+		for (i = 0; i < numNodes; i++)
+		{
+			if (ggaOneLeak(&ggaSolver, i, delta, 
+				MATRIX_COLUMN(largePressureMatrix, i)) != 0)
+				oneLeak(i + 1, delta, numNodes, i);
+		}
+		return;
+	}
+	
+#ifdef EPANET_2_2
+	if (sensitivityThreads > 1 && threadedOneLeaks(numNodes) == 0)
+		return;
+#endif
+	
+	if (largePressureMatrix.shared && forkedOneLeaks(numNodes) == 0)
+		return;
+	
+	for(i = 1; i <= numNodes; i++)
+	{		
+		oneLeak(i, delta, numNodes, i-1);		
+	}
+}
+
+//FUNCTION
+//Simulate again, at the network's own accuracy, the loose sweep columns of 
+//	the nodes the current solution puts a leak of at least minLeakThreshold 
+//	on, and patch them into the model. refined is set to the number of 
+//	columns redone
+int refineSupport(SolverModel *model, int numNodes, int *refined)
+{
+	int i, j, nz, numRows, error;
+	int *cind, *vind;
+	double *cval, *leaks, *pressures, *column;
+	
+	*refined = 0;
+	numRows = largeA.rows;
+	
+	leaks = (double *) malloc(numNodes * sizeof(double));
+	
+	//No solution, nothing to refine
+	if (solverGetX(model, 0, numNodes, leaks) != 0)
+	{
+		free(leaks);
+		return 0;
+	}
+	
+	for (j = 0; j < numNodes; j++)
+	{
+		if (looseColumns[j] && leaks[j] >= minLeakThreshold)
+			(*refined)++;
+	}
+	if (*refined == 0)
+	{
+		free(leaks);
+		return 0;
+	}
+	
+	cind = (int *) malloc((size_t)(*refined) * numRows * 2 * sizeof(int));
+	vind = (int *) malloc((size_t)(*refined) * numRows * 2 * sizeof(int));
+	cval = (double *) malloc((size_t)(*refined) * numRows * 2 * sizeof(double));
+	
+	nz = 0;
+	for (j = 0; j < numNodes; j++)
+	{
+		if (!looseColumns[j] || leaks[j] < minLeakThreshold)
+			continue;
+		
+		oneLeak(j + 1, delta, numNodes, j);
+		looseColumns[j] = 0;
+		
+		pressures = MATRIX_COLUMN(largePressureMatrix, j);
+		column = MATRIX_COLUMN(largeA, j);
+		for (i = 0; i < numRows; i++)
+		{
+			column[i] = (baseCasePressureMatrix[i] - pressures[i]) / delta;
+			
+			cind[nz] = i;
+			vind[nz] = j;
+			cval[nz] = column[i];
+			nz++;
+			
+			cind[nz] = numRows + i;
+			vind[nz] = j;
+			cval[nz] = -column[i];
+			nz++;
+		}
+	}
+	
+	error = solverChangeCoeffs(model, nz, cind, vind, cval);
+	
+	printf("\n%d loose sensitivity columns redone at full accuracy\n", *refined);
+	
+	free(leaks);
+	free(cind);
+	free(vind);
+	free(cval);
+	
+	return error;
+}
+
+//Header written in front of the pressure matrix in the sensitivity store
+typedef struct
+{
+	char magic[8];
+	unsigned long long key;
+	int rows;
+	int cols;
+} SensitivityStoreHeader;
+
+//FUNCTION
+//FNV-1a hash, used to key the sensitivity store
+unsigned long long hashBytes(unsigned long long hash, const void *data, 
+	size_t length)
+{
+	const unsigned char *bytes;
+	size_t i;
+	
+	bytes = (const unsigned char *) data;
+	for (i = 0; i < length; i++)
+	{
+		hash ^= bytes[i];
+		hash *= 1099511628211ULL;
+	}
+	
+	return hash;
+}
+
+//FUNCTION
+//Hash of the network file contents, delta and the hydraulic options and 
+//	session settings that affect the single leak pressures. Returns 0 if the network file cannot 
+//	be read
+unsigned long long networkKey(int numNodes)
+{
+	int options[] = {EN_TRIALS, EN_ACCURACY, EN_TOLERANCE, EN_EMITEXPON, 
+		EN_DEMANDMULT};
+	unsigned long long key;
+	unsigned char buffer[4096];
+	size_t length;
+	float value;
+	int i;
+	FILE *network;
+	
+	network = fopen(inputFile, "rb");
+	if (!network)
+		return 0;
+	
+	key = 14695981039346656037ULL;
+	while ((length = fread(buffer, 1, sizeof(buffer), network)) > 0)
+	{
+		key = hashBytes(key, buffer, length);
+	}
+	fclose(network);
+	
+	key = hashBytes(key, &numNodes, sizeof(int));
+	key = hashBytes(key, &delta, sizeof(double));
+	key = hashBytes(key, &sensitivityMode, sizeof(int));
+	
+	//Whether the leaks start from the base case flows changes the pressures
+	//	within the solver's accuracy
+	key = hashBytes(key, &hydraulicSession, sizeof(int));
+	
+	for (i = 0; i < 5; i++)
+	{
+		ENgetoption(options[i], &value);
+		key = hashBytes(key, &value, sizeof(float));
+	}
+	
+	return key;
+}
+
+//FUNCTION
+//Key for the sensitivity store, the network key plus the time settings 
+//	that decide which instants the pressures are read at. Returns 0 (store 
+//	disabled) if the network file cannot be read
+unsigned long long sensitivityStoreKey(int numNodes)
+{
+	int timeParameters[] = {EN_DURATION, EN_HYDSTEP, EN_PATTERNSTEP, 
+		EN_PATTERNSTART, EN_REPORTSTEP, EN_REPORTSTART};
+	unsigned long long key;
+	long timeValue;
+	int i;
+	
+	key = networkKey(numNodes);
+	if (key == 0)
+		return 0;
+	
+	key = hashBytes(key, &reportPeriods, sizeof(int));
+	
+	for (i = 0; i < 6; i++)
+	{
+		ENgettimeparam(timeParameters[i], &timeValue);
+		key = hashBytes(key, &timeValue, sizeof(long));
+	}
+	
+	return key;
+}
+
+//FUNCTION
+//Fill largePressureMatrix from the sensitivity store, which is mapped 
+//	read-only. Returns 0 on success, non-zero if there is no store or it was 
+//	written for a different network, delta or set of options
+int loadSensitivityStore(int numNodes)
+{
+	SensitivityStoreHeader *header;
+	struct stat info;
+	double *stored;
+	void *mapped;
+	size_t size;
+	int j, rows, fd;
+	
+	if (sensitivityStore[0] == '\0' || storeKey == 0)
+		return 1;
+	
+	rows = largePressureMatrix.rows;
+	size = sizeof(SensitivityStoreHeader) + 
+		((size_t)rows * numNodes * sizeof(double));
+	
+	fd = open(sensitivityStore, O_RDONLY);
+	if (fd < 0)
+		return 1;
+	if (fstat(fd, &info) != 0 || (size_t)info.st_size != size)
+	{
+		close(fd);
+		return 1;
+	}
+	mapped = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (mapped == MAP_FAILED)
+		return 1;
+	
+	header = (SensitivityStoreHeader *) mapped;
+	if (memcmp(header->magic, "L1SENS2", 8) != 0 || header->key != storeKey ||
+		header->rows != rows || header->cols != numNodes)
+	{
+		munmap(mapped, size);
+		return 1;
+	}
+	
+	stored = (double *)(header + 1);
+	for (j = 0; j < numNodes; j++)
+	{
+		memcpy(MATRIX_COLUMN(largePressureMatrix, j), 
+			stored + ((size_t)j * rows), rows * sizeof(double));
+	}
+	
+	munmap(mapped, size);
+	printf("\nSensitivity matrix loaded from %s\n", sensitivityStore);
+	return 0;
+}
+
+//FUNCTION
+//Write largePressureMatrix to the sensitivity store. The file is written 
+//	under a temporary name and renamed so a reader never sees half a matrix
+int saveSensitivityStore(int numNodes)
+{
+	SensitivityStoreHeader header;
+	char tempName[60];
+	FILE *store;
+	int j, error;
+	
+	if (sensitivityStore[0] == '\0' || storeKey == 0)
+		return 1;
+	
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, "L1SENS2", 8);
+	header.key = storeKey;
+	header.rows = largePressureMatrix.rows;
+	header.cols = numNodes;
+	
+	sprintf(tempName, "%s.tmp", sensitivityStore);
+	store = fopen(tempName, "wb");
+	if (!store)
+		return 1;
+	
+	error = (fwrite(&header, sizeof(header), 1, store) != 1);
+	for (j = 0; j < numNodes && !error; j++)
+	{
+		error = (fwrite(MATRIX_COLUMN(largePressureMatrix, j), sizeof(double), 
+			header.rows, store) != (size_t)header.rows);
+	}
+	if (fclose(store) != 0)
+		error = 1;
+	if (!error)
+		error = rename(tempName, sensitivityStore);
+	
+	if (error)
+	{
+		remove(tempName);
+		printf("\nCould not write sensitivity store %s\n", sensitivityStore);
+	}
+	
+	return error;
+}
+
+//Header of the time-of-day sensitivity library. It is followed by one 
+//	block per slice, the base case pressures and then the columns of A
+typedef struct
+{
+	char magic[8];
+	unsigned long long key;
+	int rows;
+	int slices;
+	long sliceInterval;
+	long cycle; //Demand pattern cycle the slices cover
+} SensitivityLibraryHeader;
+
+//FUNCTION
+//Length of the demand pattern cycle in seconds, that of the longest pattern
+long patternCycle()
+{
+	int i, count, length;
+	long step, cycle;
+	
+	ENgetcount(EN_PATTERNCOUNT, &count);
+	ENgettimeparam(EN_PATTERNSTEP, &step);
+	
+	cycle = step;
+	for (i = 1; i <= count; i++)
+	{
+		ENgetpatternlen(i, &length);
+		if ((long)length * step > cycle)
+			cycle = (long)length * step;
+	}
+	
+	return cycle;
+}
+
+//FUNCTION
+//Build the time-of-day library, a snapshot base case and A matrix for every
+//	librarySlice of the demand pattern cycle. The toolkit is put back to the
+//	run's own time settings afterwards. Returns 0 on success
+int buildSensitivityLibrary(int numNodes, unsigned long long key)
+{
+	SensitivityLibraryHeader header;
+	long duration, patternStart, savedTime;
+	double *pressures, *column;
+	char tempName[60];
+	FILE *library;
+	int s, i, j, error;
+	
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, "L1LIB1", 7);
+	header.key = key;
+	header.rows = numNodes;
+	header.sliceInterval = librarySlice;
+	header.cycle = patternCycle();
+	header.slices = (int)((header.cycle + librarySlice - 1) / librarySlice);
+	
+	sprintf(tempName, "%s.tmp", sensitivityLibrary);
+	library = fopen(tempName, "wb");
+	if (!library)
+		return 1;
+	
+	printf("\nBuilding sensitivity library %s, %d slices\n", 
+		sensitivityLibrary, header.slices);
+	
+	ENgettimeparam(EN_DURATION, &duration);
+	ENgettimeparam(EN_PATTERNSTART, &patternStart);
+	savedTime = analysisTime;
+	
+	//Every slice is a snapshot, reported at time 0
+	analysisTime = reportTimes[0] = 0;
+	ENsettimeparam(EN_DURATION, 0);
+	
+	error = (fwrite(&header, sizeof(header), 1, library) != 1);
+	for (s = 0; s < header.slices && !error; s++)
+	{
+		ENsettimeparam(EN_PATTERNSTART, 
+			patternStart - patternOffset + s * librarySlice);
+		
+		analyzeBaseCase(numNodes);
+		sensitivitySweep(numNodes);
+		
+		error = (fwrite(baseCasePressureMatrix, sizeof(double), numNodes, 
+			library) != (size_t)numNodes);
+		for (j = 0; j < numNodes && !error; j++)
+		{
+			pressures = MATRIX_COLUMN(largePressureMatrix, j);
+			column = MATRIX_COLUMN(largeA, j);
+			for (i = 0; i < numNodes; i++)
+			{
+				column[i] = (baseCasePressureMatrix[i] - pressures[i]) / delta;
+			}
+			error = (fwrite(column, sizeof(double), numNodes, library) != 
+				(size_t)numNodes);
+		}
+	}
+	
+	ENsettimeparam(EN_DURATION, duration);
+	ENsettimeparam(EN_PATTERNSTART, patternStart);
+	analysisTime = reportTimes[0] = savedTime;
+	
+	if (fclose(library) != 0)
+		error = 1;
+	if (!error)
+		error = rename(tempName, sensitivityLibrary);
+	
+	if (error)
+	{
+		remove(tempName);
+		printf("\nCould not write sensitivity library %s\n", sensitivityLibrary);
+	}
+	
+	return error;
+}
+
+//FUNCTION
+//Fill the base case pressures and largeA from the library slices either 
+//	side of the analysis instant, interpolated or the nearest one. The 
+//	library is mapped read-only. Returns 0 on success, non-zero if there is 
+//	no library or it was built for a different network, delta or options
+int loadLibrarySlices(int numNodes, unsigned long long key)
+{
+	SensitivityLibraryHeader *header;
+	struct stat info;
+	double *first, *second, *column, weight, position, span;
+	void *mapped;
+	size_t sliceSize, size;
+	long time;
+	int i, j, fd, slice, next;
+	
+	fd = open(sensitivityLibrary, O_RDONLY);
+	if (fd < 0)
+		return 1;
+	if (fstat(fd, &info) != 0 || 
+		(size_t)info.st_size < sizeof(SensitivityLibraryHeader))
+	{
+		close(fd);
+		return 1;
+	}
+	size = (size_t)info.st_size;
+	mapped = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (mapped == MAP_FAILED)
+		return 1;
+	
+	header = (SensitivityLibraryHeader *) mapped;
+	sliceSize = (size_t)numNodes * (numNodes + 1);
+	if (memcmp(header->magic, "L1LIB1", 7) != 0 || header->key != key ||
+		header->rows != numNodes || header->slices < 1 || 
+		header->sliceInterval != librarySlice ||
+		size != sizeof(SensitivityLibraryHeader) + 
+			header->slices * sliceSize * sizeof(double))
+	{
+		munmap(mapped, size);
+		return 1;
+	}
+	
+	//Position of the analysis instant in the pattern cycle
+	time = (analysisTime + patternOffset) % header->cycle;
+	slice = (int)(time / header->sliceInterval);
+	if (slice >= header->slices)
+		slice = header->slices - 1;
+	next = (slice + 1) % header->slices;
+	span = (double)header->sliceInterval;
+	if (slice == header->slices - 1)
+		span = (double)(header->cycle - (long)slice * header->sliceInterval);
+	position = (double)(time - (long)slice * header->sliceInterval);
+	weight = position / span;
+	if (!libraryInterpolation)
+		weight = (weight < 0.5) ? 0.0 : 1.0;
+	
+	first = (double *)(header + 1) + slice * sliceSize;
+	second = (double *)(header + 1) + next * sliceSize;
+	
+	for (i = 0; i < numNodes; i++)
+	{
+		baseCasePressureMatrix[i] = (1.0 - weight) * first[i] + 
+			weight * second[i];
+	}
+	for (j = 0; j < numNodes; j++)
+	{
+		column = MATRIX_COLUMN(largeA, j);
+		for (i = 0; i < numNodes; i++)
+		{
+			column[i] = (1.0 - weight) * first[numNodes * (j + 1) + i] + 
+				weight * second[numNodes * (j + 1) + i];
+		}
+	}
+	
+	munmap(mapped, size);
+	printf("\nSensitivity library slices %d and %d, weight %f\n", 
+		slice, next, weight);
+	return 0;
+}
+
+//FUNCTION
+//Take the base case and A matrix from the time-of-day library, building the
+//	library first if it is missing or stale. Returns non-zero if the library
+//	is disabled or cannot be used, in which case the run simulates as usual
+int useSensitivityLibrary(int numNodes)
+{
+	unsigned long long key;
+	long patternStep;
+	
+	if (sensitivityLibrary[0] == '\0' || librarySlice <= 0)
+		return 1;
+	
+	//Slices hold a single instant each
+	if (reportPeriods > 1)
+	{
+		printf("\nSensitivity library does not cover stacked report times\n");
+		return 1;
+	}
+	
+	key = networkKey(numNodes);
+	if (key == 0)
+		return 1;
+	
+	ENgettimeparam(EN_PATTERNSTEP, &patternStep);
+	key = hashBytes(key, &patternStep, sizeof(long));
+	key = hashBytes(key, &librarySlice, sizeof(long));
+	
+	if (loadLibrarySlices(numNodes, key) == 0)
+		return 0;
+	
+	if (buildSensitivityLibrary(numNodes, key) != 0)
+		return 1;
+	
+	return loadLibrarySlices(numNodes, key);
+}
+
+//Header written in front of the pressures in the base case store
+typedef struct
+{
+	char magic[8];
+	unsigned long long key;
+	int rows;
+} BaseCaseHeader;
+
+//FUNCTION
+//Fill baseCasePressureMatrix from the base case store. Returns 0 on 
+//	success, non-zero if there is no store or it was written for a different
+//	network, delta or set of options
+int loadBaseCase(int numNodes)
+{
+	BaseCaseHeader header;
+	FILE *store;
+	int rows, error;
+	
+	if (baseCaseStore[0] == '\0' || storeKey == 0)
+		return 1;
+	
+	store = fopen(baseCaseStore, "rb");
+	if (!store)
+		return 1;
+	
+	rows = numNodes * reportPeriods;
+	error = (fread(&header, sizeof(header), 1, store) != 1 ||
+		memcmp(header.magic, "L1BASE1", 8) != 0 || header.key != storeKey ||
+		header.rows != rows);
+	if (!error)
+		error = (fread(baseCasePressureMatrix, sizeof(double), rows, store) != 
+			(size_t)rows);
+	fclose(store);
+	
+	if (!error)
+		printf("\nBase case loaded from %s\n", baseCaseStore);
+	
+	return error;
+}
+
+//FUNCTION
+//Write baseCasePressureMatrix to the base case store, under a temporary 
+//	name that is then renamed
+int saveBaseCase(int numNodes)
+{
+	BaseCaseHeader header;
+	char tempName[60];
+	FILE *store;
+	int error;
+	
+	if (baseCaseStore[0] == '\0' || storeKey == 0)
+		return 1;
+	
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, "L1BASE1", 8);
+	header.key = storeKey;
+	header.rows = numNodes * reportPeriods;
+	
+	sprintf(tempName, "%s.tmp", baseCaseStore);
+	store = fopen(tempName, "wb");
+	if (!store)
+		return 1;
+	
+	error = (fwrite(&header, sizeof(header), 1, store) != 1 ||
+		fwrite(baseCasePressureMatrix, sizeof(double), header.rows, store) != 
+		(size_t)header.rows);
+	if (fclose(store) != 0)
+		error = 1;
+	if (!error)
+		error = rename(tempName, baseCaseStore);
+	
+	if (error)
+	{
+		remove(tempName);
+		printf("\nCould not write base case store %s\n", baseCaseStore);
+	}
+	
+	return error;
+}
+
+//FUNCTION
+//Multi-process version of the single leak loop for the legacy toolkit. Each 
+//	child is forked with the network already open and simulates a contiguous
+//	range of nodes straight into the shared largePressureMatrix. Ranges whose
+//	worker could not be forked or did not exit cleanly are redone here
+int forkedOneLeaks(int numNodes)
+{
+	pid_t *workers;
+	int i, w, first, last, status;
+	
+	workers = (pid_t *) calloc(sensitivityProcesses, sizeof(pid_t));
+	
+	//Anything still buffered would otherwise be written once per child
+	fflush(NULL);
+	
+	for (w = 0; w < sensitivityProcesses; w++)
+	{
+		first = (w * numNodes) / sensitivityProcesses;
+		last = ((w + 1) * numNodes) / sensitivityProcesses;
+		
+		workers[w] = fork();
+		if (workers[w] == 0)
+		{
+			for(i = first + 1; i <= last; i++)
+			{
+				oneLeak(i, delta, numNodes, i-1);
+			}
+			_exit(0);
+		}
+	}
+	
+	for (w = 0; w < sensitivityProcesses; w++)
+	{
+		status = 1;
+		if (workers[w] > 0)
+			waitpid(workers[w], &status, 0);
+		
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+		{
+			printf("\nSensitivity worker %d failed, running its nodes here\n", w);
+			first = (w * numNodes) / sensitivityProcesses;
+			last = ((w + 1) * numNodes) / sensitivityProcesses;
+			for(i = first + 1; i <= last; i++)
+			{
+				oneLeak(i, delta, numNodes, i-1);
+			}
+		}
+	}
+	
+	free(workers);
+	return 0;
+}
+
+#ifdef EPANET_2_2
+//Work shared by the sensitivity threads, columns are handed out one at a time
+//	so that slow simulations do not leave the other threads idle
+typedef struct
+{
+	EN_Project project;
+	double *pressures; //Every node, filled by EN_getnodevalues
+	int nodeCount;
+	int *nextColumn;
+	pthread_mutex_t *lock;
+} SweepWorker;
+
+//FUNCTION
+//Thread body for the parallel sweep, simulates columns until none are left
+void *oneLeakWorker(void *arg)
+{
+	SweepWorker *worker;
+	int column, count;
 	
-	//Create the leak
-	ENsetnodevalue(index, EN_EMITTER, emitterCoeff);
+	worker = (SweepWorker *) arg;
+	
+	EN_getcount(worker->project, EN_NODECOUNT, &count);
+	worker->pressures = (double *) calloc(count, sizeof(double));
+	
+	//A persistent session holds the worker's solver open for all its columns
+	if (hydraulicSession)
+		EN_openH(worker->project);
+	
+	do
+	{
+		pthread_mutex_lock(worker->lock);
+		column = *(worker->nextColumn);
+		if (column < worker->nodeCount)
+			(*(worker->nextColumn))++;
+		pthread_mutex_unlock(worker->lock);
+		
+		if (column < worker->nodeCount)
+			projectOneLeak(worker->project, column + 1, delta, 
+				worker->nodeCount, column, worker->pressures);
+	} while (column < worker->nodeCount);
+	
+	if (hydraulicSession)
+		EN_closeH(worker->project);
+	free(worker->pressures);
+	
+	return NULL;
+}
+
+//FUNCTION
+//Parallel version of the single leak loop. Every worker opens its own copy of
+//	the network since the legacy toolkit state cannot be shared between 
+//	threads. Returns non-zero if the workers could not be set up, in which 
+//	case nothing has been simulated
+int threadedOneLeaks(int numNodes)
+{
+	SweepWorker *workers;
+	pthread_t *threads;
+	pthread_mutex_t lock;
+	int i, numWorkers, opened, nextColumn, error;
+	long patternStart, reportStart, reportStep;
+	float accuracy;
+	char *started;
+	
+	numWorkers = sensitivityThreads;
+	if (numWorkers > numNodes)
+		numWorkers = numNodes;
+	opened = nextColumn = error = 0;
+	
+	workers = (SweepWorker *) calloc(numWorkers, sizeof(SweepWorker));
+	threads = (pthread_t *) calloc(numWorkers, sizeof(pthread_t));
+	started = (char *) calloc(numWorkers, sizeof(char));
+	pthread_mutex_init(&lock, NULL);
+	
+	ENgettimeparam(EN_PATTERNSTART, &patternStart);
+	ENgettimeparam(EN_REPORTSTART, &reportStart);
+	ENgettimeparam(EN_REPORTSTEP, &reportStep);
+	ENgetoption(EN_ACCURACY, &accuracy);
+	
+	for (i = 0; i < numWorkers; i++)
+	{
+		workers[i].nodeCount = numNodes;
+		workers[i].nextColumn = &nextColumn;
+		workers[i].lock = &lock;
+		
+		error = EN_createproject(&workers[i].project);
+		if (error) 
+			break;
+		opened++;
+		
+		error = EN_open(workers[i].project, inputFile, "", "");
+		if (error)
+			break;
+		
+		//Stop at the same instant as the global project
+		EN_settimeparam(workers[i].project, EN_PATTERNSTART, patternStart);
+		EN_settimeparam(workers[i].project, EN_DURATION, analysisTime);
+		EN_settimeparam(workers[i].project, EN_REPORTSTART, reportStart);
+		EN_settimeparam(workers[i].project, EN_REPORTSTEP, reportStep);
+		
+		//A loose sweep runs at the same accuracy on every worker
+		EN_setoption(workers[i].project, EN_ACCURACY, accuracy);
+	}
+	
+	if (!error)
+	{
+		for (i = 0; i < numWorkers; i++)
+		{
+			if (pthread_create(&threads[i], NULL, oneLeakWorker, &workers[i])
+				== 0)
+				started[i] = 1;
+		}
+		
+		//Any worker that failed to start is run here, it simply drains 
+		//	whatever columns the other threads have not taken yet
+		for (i = 0; i < numWorkers; i++)
+		{
+			if (started[i])
+				pthread_join(threads[i], NULL);
+			else
+				oneLeakWorker(&workers[i]);
+		}
+	}
+	else
+	{
+		printf("\nParallel sensitivity unavailable (EPANET error %d)\n", error);
+	}
+	
+	for (i = 0; i < opened; i++)
+	{
+		EN_close(workers[i].project);
+		EN_deleteproject(workers[i].project);
+	}
+	
+	pthread_mutex_destroy(&lock);
+	free(workers);
+	free(threads);
+	free(started);
+	
+	return error;
+}
+
+//FUNCTION
+//oneLeak against an independent project handle. Values go through float on
+//	the way in and out so the columns match the legacy ENxxx calls exactly
+void projectOneLeak(EN_Project ph, int index, double emitterCoeff, 
+	int nodeCount, int columnNumber, double *pressures) 
+{	
+	int i, period;
+	long t, tstep;
+	
+	i = 0;
 	
-	ENopenH();  
-	ENinitH(0);
+	//Create the leak
+	EN_setnodevalue(ph, index, EN_EMITTER, (float)emitterCoeff);
+	
+	//In a persistent session the worker holds the solver open, otherwise it
+	//	is opened for this column alone. Either way the column starts from 
+	//	the base case flows or the toolkit's defaults, as the serial oneLeak 
+	//	does
+	if (!hydraulicSession)
+		EN_openH(ph);
+	initProjectSolve(&session, ph, !hydraulicSession);
 
 	//Run the hydraulic analysis
 	do {  	
-		ENrunH(&t);		
-		if (t%hydraulicTimeStep == 0)
-		{
-			for (i = 1; i <= nodeCount; i++)
-			{			
-				ENgetnodevalue(i, EN_PRESSURE, &pressure);
-				largePressureMatrix[i-1][columnNumber] = pressure;			
-            }
-         }
-		ENnextH(&tstep); 
+		EN_runH(ph, &t);		
+		period = reportPeriod(t);
+		if (period >= 0)
+		{
+			EN_getnodevalues(ph, EN_PRESSURE, pressures);
+			for (i = 0; i < nodeCount; i++)
+			{
+				MATRIX(largePressureMatrix, period * nodeCount + i, 
+					columnNumber) = (float)pressures[i];
+			}
+		}
+		EN_nextH(ph, &tstep); 
 	} while (tstep > 0); 
 	
-	//Close the hydraulic solver
-	ENcloseH();
+	if (!hydraulicSession)
+		EN_closeH(ph);
 	
 	//"Fix" the leak
-	ENsetnodevalue(index, EN_EMITTER, 0.0);
+	EN_setnodevalue(ph, index, EN_EMITTER, 0.0);
+}
+#endif
+
+//FUNCTION
+//Largest leak magnitude an optimal solution can put at each node. With 
+//	x >= 0 and every column sum s_j of A non-negative, as leaks only lower
+//	pressures, |A x - b| >= x_j s_j - |b|, so a solution with x_j > 2 |b| / 
+//	s_j is worse than no leak at all. A bound is never set below 
+//	maxLeakSize, so the leaks that made the observations stay feasible. 
+//	Returns the number of nodes bounded, the rest are left at GRB_INFINITY
+int leakBounds(int numNodes, double *bounds)
+{
+	int i, j, rows, count;
+	double observed, sum, *column;
+	
+	rows = largeA.rows;
+	observed = 0.0;
+	for (i = 0; i < rows; i++)
+	{
+		observed += fabs(b[i]);
+	}
+	
+	count = 0;
+	for (j = 0; j < numNodes; j++)
+	{
+		column = MATRIX_COLUMN(largeA, j);
+		sum = 0.0;
+		for (i = 0; i < rows; i++)
+		{
+			sum += column[i];
+		}
+		
+		bounds[j] = GRB_INFINITY;
+		if (sum < 0.0)
+		{
+			//The bound does not hold for any node
+			for (j = 0; j < numNodes; j++)
+			{
+				bounds[j] = GRB_INFINITY;
+			}
+			return 0;
+		}
+		if (sum > 0.0)
+		{
+			bounds[j] = 2.0 * observed / sum;
+			if (bounds[j] < maxLeakSize)
+				bounds[j] = maxLeakSize;
+			count++;
+		}
+	}
+	
+	return count;
+}
+
+//FUNCTION
+//Bound the leak magnitudes with leakBounds and every residual with |b|, the
+//	objective of the no leak solution, before a solve. Has to be redone 
+//	whenever b or A changes
+int tightenBounds(SolverModel *model, int numNodes)
+{
+	int i, rows, count, error;
+	double observed, *upper;
+	
+	if (!boundTightening)
+		return 0;
+	
+	rows = largeA.rows;
+	upper = (double *) malloc((numNodes + rows) * sizeof(double));
+	
+	count = leakBounds(numNodes, upper);
+	
+	observed = 0.0;
+	for (i = 0; i < rows; i++)
+	{
+		observed += fabs(b[i]);
+	}
+	for (i = 0; i < rows; i++)
+	{
+		upper[numNodes + i] = observed;
+	}
+	
+	error = solverSetUpper(model, 0, numNodes + rows, upper);
+	if (!error)
+		printf("\nBounds tightened: %d of %d leak magnitudes, %d residuals\n", 
+			count, numNodes, rows);
+	
+	free(upper);
+	
+	return error;
+}
+
+//FUNCTION
+//Per node M for the tight linking rows, the leak bounds capped at bigM
+void linkBounds(int numNodes, double *bounds)
+{
+	int j;
+	
+	leakBounds(numNodes, bounds);
+	for (j = 0; j < numNodes; j++)
+	{
+		if (bounds[j] > bigM)
+			bounds[j] = bigM;
+	}
+}
+
+//FUNCTION
+//Recompute the tight M of every linking row after b or A changed
+int updateLinkBounds(SolverModel *model, int numNodes)
+{
+	int i, error, *cind, *vind;
+	double *cval;
+	
+	if (linkingFormulation != 2)
+		return 0;
+	
+	cind = (int *) malloc(numNodes * sizeof(int));
+	vind = (int *) malloc(numNodes * sizeof(int));
+	cval = (double *) malloc(numNodes * sizeof(double));
+	
+	linkBounds(numNodes, cval);
+	for (i = 0; i < numNodes; i++)
+	{
+		cind[i] = largeA.rows * 2 + i;
+		vind[i] = numNodes + largeA.rows + i;
+		cval[i] = -cval[i];
+	}
+	
+	error = solverChangeCoeffs(model, numNodes, cind, vind, cval);
+	
+	free(cind);
+	free(vind);
+	free(cval);
+	
+	return error;
+}
+
+//FUNCTION
+//Start the next solve from the previous solution sol, made feasible for the
+//	new b and A first. Leaks are kept only where their binary is set and 
+//	clipped to leakBounds and, with tight M rows, to the M of their node. 
+//	The residuals are then |b - A x|. Should one exceed the |b| bound 
+//	tightenBounds gives it, the no leak solution is started from instead.
+//	The SOS1 slacks are left for the solver to fill in
+int updateStart(SolverModel *model, int numNodes, double *sol)
+{
+	int i, j, rows, binary, bounded;
+	double observed, *upper, *link, *column;
+	
+	rows = largeA.rows;
+	binary = numNodes + rows;
+	upper = (double *) malloc(numNodes * sizeof(double));
+	link = (double *) malloc(numNodes * sizeof(double));
+	
+	for (j = 0; j < numNodes; j++)
+	{
+		upper[j] = GRB_INFINITY;
+	}
+	if (boundTightening)
+		leakBounds(numNodes, upper);
+	if (linkingFormulation == 2)
+		linkBounds(numNodes, link);
+	
+	for (j = 0; j < numNodes; j++)
+	{
+		sol[binary + j] = (sol[binary + j] > 0.5) ? 1.0 : 0.0;
+		if (sol[binary + j] == 0.0 || sol[j] < 0.0)
+			sol[j] = 0.0;
+		if (sol[j] > upper[j])
+			sol[j] = upper[j];
+		if (linkingFormulation == 2 && sol[j] > link[j])
+			sol[j] = link[j];
+	}
+	
+	for (i = 0; i < rows; i++)
+	{
+		sol[numNodes + i] = b[i];
+	}
+	for (j = 0; j < numNodes; j++)
+	{
+		column = MATRIX_COLUMN(largeA, j);
+		for (i = 0; i < rows; i++)
+		{
+			sol[numNodes + i] -= column[i] * sol[j];
+		}
+	}
+	
+	observed = 0.0;
+	for (i = 0; i < rows; i++)
+	{
+		observed += fabs(b[i]);
+	}
+	bounded = 1;
+	for (i = 0; i < rows; i++)
+	{
+		sol[numNodes + i] = fabs(sol[numNodes + i]);
+		if (boundTightening && sol[numNodes + i] > observed)
+			bounded = 0;
+	}
+	
+	if (!bounded)
+	{
+		for (j = 0; j < numNodes; j++)
+		{
+			sol[j] = 0.0;
+			sol[binary + j] = 0.0;
+		}
+		for (i = 0; i < rows; i++)
+		{
+			sol[numNodes + i] = fabs(b[i]);
+		}
+	}
+	
+	free(upper);
+	free(link);
+	
+	return solverSetStart(model, 0, (numNodes * 2) + rows, sol);
+}
+
+//FUNCTION
+//Link each leak magnitude to its binary with the SOS1 pairs or indicator 
+//	constraints of linkingFormulation, once the variables are in the model.
+//	Both are Gurobi only, addL1Model gives other backends tight M rows
+int addLinkConstraints(SolverModel *model, int numNodes)
+{
+	int i, error, binary, *types, *beg, *ind;
+	double *weights;
+	
+	binary = numNodes + largeA.rows;
+	error = 0;
+	
+	if (model->backend != SOLVER_GUROBI)
+		return 0;
+	
+	if (linkingFormulation == 1)
+	{
+		//Either the leak magnitude or the slack 1 - binary is zero
+		types = (int *) malloc(numNodes * sizeof(int));
+		beg = (int *) malloc(numNodes * sizeof(int));
+		ind = (int *) malloc(numNodes * 2 * sizeof(int));
+		weights = (double *) malloc(numNodes * 2 * sizeof(double));
+		
+		for (i = 0; i < numNodes; i++)
+		{
+			types[i] = GRB_SOS_TYPE1;
+			beg[i] = i * 2;
+			ind[i * 2] = i;
+			ind[i * 2 + 1] = binary + numNodes + i;
+			weights[i * 2] = 1.0;
+			weights[i * 2 + 1] = 2.0;
+		}
+		
+		error = GRBaddsos(model->model, numNodes, numNodes * 2, types, beg, 
+			ind, weights);
+		
+		free(types);
+		free(beg);
+		free(ind);
+		free(weights);
+	}
+	
+#if GRB_VERSION_MAJOR >= 7
+	if (linkingFormulation == 3)
+	{
+		double one = 1.0;
+		
+		//Binary at 0 forces the leak magnitude to 0
+		for (i = 0; i < numNodes && !error; i++)
+		{
+			error = GRBaddgenconstrIndicator(model->model, NULL, binary + i, 0, 
+				1, &i, &one, GRB_LESS_EQUAL, 0.0);
+		}
+	}
+#endif
+	
+	if (!error)
+		error = GRBupdatemodel(model->model);
+	
+	return error;
+}
+
+//FUNCTION
+//Solve scenario k once under each linking formulation solverBackend 
+//	supports, each in a fresh model so none is warm started, and append the
+//	run times and branch and bound node counts to LinkingBenchmark.csv
+int benchmarkLinking(int numNodes, int k)
+{
+	char *names[] = {"bigM", "SOS1", "tightM", "indicator"};
+	char sequentialFile[100];
+	SolverModel bench;
+	int formulation, saved, error;
+	
+	sequentialFile[0] = '\0';
+	strcat(sequentialFile, globalDirName);
+	strcat(sequentialFile, "/LinkingBenchmark.csv");
+	
+	ptr_file = fopen(sequentialFile, (k == 0) ? "w" : "a");
+	if (!ptr_file)
+		return 1;
+	
+	if (k == 0)
+		fprintf(ptr_file, "Run #, Formulation, Status, Objective_Value, "
+			"Runtime, Nodes\n");
+	
+	saved = linkingFormulation;
+	error = 0;
+	
+	for (formulation = 0; formulation < 4 && !error; formulation++)
+	{
+#if GRB_VERSION_MAJOR < 7
+		if (formulation == 3)
+			break;
+#endif
+		if (solverBackend != SOLVER_GUROBI && (formulation == 1 || 
+			formulation == 3))
+			continue;
+		linkingFormulation = formulation;
+		
+		error = openSolver(&bench, solverBackend, "L1_Benchmark.log", 
+			"L1MIP");
+		if (!error)
+			error = addL1Model(&bench, numNodes);
+		if (!error)
+			error = solverOptimize(&bench);
+		
+		if (!error)
+			fprintf(ptr_file, "%d, %s, %d, %f, %f, %.0f\n", (k + 1), 
+				names[formulation], bench.status, bench.objval, 
+				bench.runtime, bench.nodes);
+		
+		closeSolver(&bench);
+	}
+	
+	linkingFormulation = saved;
+	fclose(ptr_file);
+	
+	return error;
+}
+
+//FUNCTION
+//Solve scenario k once on each backend built in, each in a fresh model so 
+//	none is warm started, and append the run times and branch and bound 
+//	node counts to SolverBenchmark.csv. HiGHS links by tight M rows whatever
+//	linkingFormulation says. Running it on hanoi-1.inp and Net3.inp 
+//	compares the backends on both networks
+int benchmarkSolvers(int numNodes, int k)
+{
+	int backends[] = {SOLVER_GUROBI, SOLVER_HIGHS};
+	char sequentialFile[100];
+	SolverModel bench;
+	int i, saved, error;
+	
+	sequentialFile[0] = '\0';
+	strcat(sequentialFile, globalDirName);
+	strcat(sequentialFile, "/SolverBenchmark.csv");
+	
+	ptr_file = fopen(sequentialFile, (k == 0) ? "w" : "a");
+	if (!ptr_file)
+		return 1;
+	
+	if (k == 0)
+		fprintf(ptr_file, "Run #, Network, Backend, Formulation, Status, "
+			"Objective_Value, Runtime, Nodes\n");
+	
+	saved = linkingFormulation;
+	
+	for (i = 0; i < 2; i++)
+	{
+#ifndef HAVE_HIGHS
+		if (backends[i] == SOLVER_HIGHS)
+			break;
+#endif
+		error = openSolver(&bench, backends[i], "L1_Benchmark.log", "L1MIP");
+		if (!error)
+			error = addL1Model(&bench, numNodes);
+		if (!error)
+			error = solverDualSimplex(&bench);
+		if (!error)
+			error = solverOptimize(&bench);
+		
+		if (!error)
+			fprintf(ptr_file, "%d, %s, %s, %d, %d, %f, %f, %.0f\n", (k + 1), 
+				inputFile, solverName(&bench), linkingFormulation, 
+				bench.status, bench.objval, bench.runtime, bench.nodes);
+		else
+			printf("\nSolver benchmark failed on %s: %s\n", solverName(&bench), 
+				solverError(&bench));
+		
+		closeSolver(&bench);
+		linkingFormulation = saved;
+	}
+	
+	fclose(ptr_file);
+	
+	return 0;
 }
 
 //FUNCTION
@@ -653,12 +2339,13 @@ void oneLeak(int index, double emitterCoeff, int nodeCount, int columnNumber)
 void nLeaks(int leakCount, int nodeCount) 
 {
 	long t, tstep, hydraulicTimeStep, duration;	
-	float pressure, baseDemand, demand;
-	int i;
+	float baseDemand;
+	double *values;
+	int i, period;
 	//char name[20];
 
 	i = 0;
-	totalDemand = pressure = baseDemand = demand = 0.0;
+	totalDemand = baseDemand = 0.0;
 	
 	ENgettimeparam(EN_HYDSTEP, &hydraulicTimeStep);
 	
@@ -671,34 +2358,42 @@ void nLeaks(int leakCount, int nodeCount)
 		ENsetnodevalue(leakNodes[i], EN_EMITTER, leakMagnitudes[i]);
 	}
 	
-	ENopenH();  
-	ENinitH(0);
+	beginSolve(&session);
 	
 	//Run the hydraulic analysis
 	do 
 	{  	
 		ENrunH(&t);
 		
-		for (i = 1; i <= nodeCount; i++)
-		{			
-			ENgetnodevalue(i, EN_PRESSURE, &pressure);						
-			ENgetnodevalue(i, EN_DEMAND, &demand);												
-			observedPressure[i-1] = (double)pressure;			
-			totalDemand += demand;	
+		period = reportPeriod(t);
+		if (period >= 0)
+		{
+			values = readNodeResults(&nodeResults, EN_PRESSURE);
+			memcpy(&observedPressure[period * nodeCount], values, 
+				nodeCount * sizeof(double));
 		}
 		
-		for (i = 0; i < leakCount; i++)
+		//Demands are summarized at the analysis time only
+		if (t == analysisTime)
 		{
-			ENgetnodevalue(leakNodes[i], EN_BASEDEMAND, &baseDemand);					
-			ENgetnodevalue(leakNodes[i], EN_DEMAND, &demand);			
-			leakDemands[i] = (demand - baseDemand);
+			values = readNodeResults(&nodeResults, EN_DEMAND);
+			for (i = 0; i < nodeCount; i++)
+			{
+				totalDemand += values[i];
+			}
+			
+			for (i = 0; i < leakCount; i++)
+			{
+				ENgetnodevalue(leakNodes[i], EN_BASEDEMAND, &baseDemand);
+				leakDemands[i] = (values[leakNodes[i]-1] - baseDemand);
+			}
 		}
 		
 		ENnextH(&tstep); 		
 	} while (tstep > 0); 
 	
-	//Close the hydraulic solver
-	ENcloseH();
+	//Close the hydraulic solver, unless the session keeps it
+	endSolve(&session);
 	
 	//"Fix" the leak
 	for (i = 0; i < leakCount; i++)
@@ -778,15 +2473,16 @@ int writeSummaryFile(int k, int optimstatus, double objval, double sol[])
 			fprintf(ptr_file, "  sol[%d] =, %f, Node ID:, %s \n", 
 				(i+1), sol[i], name);
 		}
-		for (i = totalNodeCount; i < (totalNodeCount * 2); i++)
+		for (i = totalNodeCount; i < (totalNodeCount + totalRowCount); i++)
 		{		  	
 			fprintf(ptr_file, "  sol[%d] =, %f, Error for sol[%d] \n",
 				(i+1), sol[i], (i + 1 - totalNodeCount));
 		}
-		for(i = (totalNodeCount * 2); i < (totalNodeCount * 3); i++)
+		for(i = (totalNodeCount + totalRowCount); 
+			i < ((totalNodeCount * 2) + totalRowCount); i++)
 		{		  	
 			fprintf(ptr_file, "  sol[%d] =, %f, binary for, sol[%d] \n",
-				(i+1), sol[i], (i - (totalNodeCount * 2) + 1));
+				(i+1), sol[i], (i - (totalNodeCount + totalRowCount) + 1));
 		}
 	} else if (optimstatus == GRB_INF_OR_UNBD) 
 	{
@@ -824,11 +2520,12 @@ int writeRawResults(int k, int optimstatus, double sol[])
 	
 	if (optimstatus == GRB_OPTIMAL) 
 	{	
-		for(i = 0; i < ((totalNodeCount * 2) - 1); i++)
+		for(i = 0; i < ((totalNodeCount + totalRowCount) - 1); i++)
 		{		  	
 			fprintf(ptr_file, "  sol[%d] =, %f \n", (i+1), sol[i]);
 		}
-		for(i = ((totalNodeCount * 2) - 1); i < (totalNodeCount * 2); i++)
+		for(i = ((totalNodeCount + totalRowCount) - 1); 
+			i < (totalNodeCount + totalRowCount); i++)
 		{		  	
 			fprintf(ptr_file, "  sol[%d] =, %f", (i+1), sol[i]);
 		}
@@ -878,6 +2575,88 @@ int writeErrorFile()
 	return 0;
 }
 
+//FUNCTION
+//Write the best hypothesisCount distinct leak sets in the solution pool of 
+//	the last solve, best objective first. A leak set is the nodes with a 
+//	magnitude of at least minLeakThreshold, pool solutions that only differ
+//	in binaries left at 1 without a leak are skipped
+int writeHypotheses(SolverModel *model, int k)
+{
+	char sequentialFile[100], buffer[10], name[10];
+	char *supports, *support;
+	int i, j, s, count, kept, error;
+	double objval, *x;
+	
+	error = GRBgetintattr(model->model, GRB_INT_ATTR_SOLCOUNT, &count);
+	if (error)
+		return error;
+	
+	sequentialFile[0] = '\0';
+	strcat(sequentialFile, globalDirName);
+	strcat(sequentialFile, "/Hypotheses_");
+	sprintf(buffer,"%d",k);
+	strcat(sequentialFile, buffer);
+	strcat(sequentialFile, ".csv");
+	
+	ptr_file = fopen(sequentialFile, "w");
+	if (!ptr_file)
+		return 1;
+	
+	fprintf(ptr_file, "Hypothesis, Objective_Value, Node ID:Magnitude...\n");
+	
+	x = (double *) malloc(totalNodeCount * sizeof(double));
+	supports = (char *) calloc(hypothesisCount * totalNodeCount, sizeof(char));
+	kept = 0;
+	
+	for (s = 0; s < count && kept < hypothesisCount; s++)
+	{
+		error = GRBsetintparam(GRBgetenv(model->model), 
+			GRB_INT_PAR_SOLUTIONNUMBER, s);
+		if (!error)
+			error = GRBgetdblattr(model->model, GRB_DBL_ATTR_POOLOBJVAL, 
+				&objval);
+		if (!error)
+			error = GRBgetdblattrarray(model->model, GRB_DBL_ATTR_XN, 0, 
+				totalNodeCount, x);
+		if (error)
+			break;
+		
+		support = supports + kept * totalNodeCount;
+		for (i = 0; i < totalNodeCount; i++)
+		{
+			support[i] = (x[i] >= minLeakThreshold);
+		}
+		for (j = 0; j < kept; j++)
+		{
+			if (memcmp(supports + j * totalNodeCount, support, 
+				totalNodeCount) == 0)
+				break;
+		}
+		if (j < kept)
+			continue;
+		
+		kept++;
+		fprintf(ptr_file, "%d, %f", kept, objval);
+		for (i = 0; i < totalNodeCount; i++)
+		{
+			if (support[i])
+			{
+				ENgetnodeid((i+1), name);
+				fprintf(ptr_file, ", %s:%f", name, x[i]);
+			}
+		}
+		fprintf(ptr_file, "\n");
+	}
+	
+	fclose(ptr_file);
+	free(x);
+	free(supports);
+	
+	printf("\nLeak hypotheses written: %d of %d pool solutions\n", kept, count);
+	
+	return error;
+}
+
 //FUNCTION
 //Print the location and magnitude of leaks to file
 int writeLeakFile(int k)
@@ -0,0 +1,104 @@
+#ifndef L1_MATRIX_H
+#define L1_MATRIX_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+//Dense matrix used by the L1 programs for the pressure and A matrices. The
+//	elements live in a single 64-byte aligned block in column-major order,
+//	so a single leak simulation fills one contiguous column and the A build
+//	and model emission loops walk memory in order. Columns are padded to a
+//	whole number of cache lines
+
+#define MATRIX_ALIGNMENT 64
+
+typedef struct
+{
+	int rows, cols;
+	size_t stride; //Doubles from the start of one column to the next
+	size_t bytes;
+	int shared; //Block is a shared mapping, visible across fork()
+	int borrowed; //Block belongs to another matrix, see shareMatrix
+	double *data;
+} DenseMatrix;
+
+//Element (i, j) and the start of column j
+#define MATRIX(m, i, j) ((m).data[(size_t)(j) * (m).stride + (i)])
+#define MATRIX_COLUMN(m, j) ((m).data + (size_t)(j) * (m).stride)
+
+//FUNCTION
+//Allocate a zeroed rows x cols matrix. A shared matrix is an anonymous
+//	shared mapping that forked workers can write into. Returns 0 on success
+static inline int createMatrix(DenseMatrix *m, int rows, int cols, int shared)
+{
+	void *block;
+	size_t columnBytes;
+
+	columnBytes = (size_t)rows * sizeof(double);
+	columnBytes = (columnBytes + MATRIX_ALIGNMENT - 1) / MATRIX_ALIGNMENT *
+		MATRIX_ALIGNMENT;
+
+	m->rows = rows;
+	m->cols = cols;
+	m->stride = columnBytes / sizeof(double);
+	m->bytes = columnBytes * cols;
+	m->shared = shared;
+	m->borrowed = 0;
+	m->data = NULL;
+	if (m->bytes == 0)
+		m->bytes = MATRIX_ALIGNMENT;
+
+	if (shared)
+	{
+		block = mmap(NULL, m->bytes, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+		if (block == MAP_FAILED)
+			return 1;
+	}
+	else
+	{
+		if (posix_memalign(&block, MATRIX_ALIGNMENT, m->bytes) != 0)
+			return 1;
+		memset(block, 0, m->bytes);
+	}
+
+	m->data = (double *) block;
+	return 0;
+}
+
+//FUNCTION
+//Make m a view of the block of source, so a matrix that is formed column by
+//	column from another one can overwrite it in place. Only source frees
+//	the block
+static inline void shareMatrix(DenseMatrix *m, DenseMatrix *source)
+{
+	*m = *source;
+	m->borrowed = 1;
+}
+
+//FUNCTION
+//Zero every element
+static inline void clearMatrix(DenseMatrix *m)
+{
+	memset(m->data, 0, m->bytes);
+}
+
+//FUNCTION
+//Release a matrix created by createMatrix
+static inline void freeMatrix(DenseMatrix *m)
+{
+	if (m->data == NULL || m->borrowed)
+	{
+		m->data = NULL;
+		return;
+	}
+
+	if (m->shared)
+		munmap((void *)m->data, m->bytes);
+	else
+		free((void *)m->data);
+	m->data = NULL;
+}
+
+#endif
@@ -0,0 +1,472 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "L1_Solver.h"
+#ifdef HAVE_HIGHS
+#include "interfaces/highs_c_api.h"
+
+//Index arrays are passed straight through, which needs the default 32 bit
+//	HighsInt
+typedef char highsIntMatchesInt[(sizeof(HighsInt) == sizeof(int)) ? 1 : -1];
+#endif
+
+//FUNCTION
+//Lower and upper bounds of a HiGHS row from its sense and right hand side
+#ifdef HAVE_HIGHS
+static void rowBounds(SolverModel *m, char sense, double rhs, double *lower,
+	double *upper)
+{
+	double infinity;
+
+	infinity = Highs_getInfinity(m->highs);
+	*lower = (sense == GRB_LESS_EQUAL) ? -infinity : rhs;
+	*upper = (sense == GRB_GREATER_EQUAL) ? infinity : rhs;
+}
+
+//FUNCTION
+//Upper bound of a HiGHS column, SOLVER_INFINITY and above are infinite
+static double columnUpper(SolverModel *m, double upper)
+{
+	return (upper >= SOLVER_INFINITY) ? Highs_getInfinity(m->highs) : upper;
+}
+#endif
+
+//FUNCTION
+//Create an empty model called name on the chosen backend, logging to 
+//	logFile. Returns non-zero if the backend is not available, e.g. no 
+//	Gurobi license or HiGHS not compiled in
+int openSolver(SolverModel *m, int backend, const char *logFile,
+	const char *name)
+{
+	int error;
+
+	memset(m, 0, sizeof(SolverModel));
+	m->backend = backend;
+	error = 0;
+
+	if (backend == SOLVER_GUROBI)
+	{
+		error = GRBloadenv(&m->env, logFile);
+		if (!error)
+			error = GRBnewmodel(m->env, &m->model, name, 0, NULL, NULL,
+				NULL, NULL, NULL);
+		return error;
+	}
+
+#ifdef HAVE_HIGHS
+	if (backend == SOLVER_HIGHS)
+	{
+		m->highs = Highs_create();
+		if (!m->highs)
+			return 1;
+		Highs_setStringOptionValue(m->highs, "log_file", logFile);
+		return 0;
+	}
+#endif
+
+	printf("\nSolver backend %d is not available in this build\n", backend);
+	return 1;
+}
+
+//FUNCTION
+//Replace the model with an empty one called name, on the same backend and
+//	environment. Parameters set on the old Gurobi model are dropped, HiGHS
+//	keeps its options
+int clearSolver(SolverModel *m, const char *name)
+{
+	int error;
+
+	error = 0;
+
+	if (m->backend == SOLVER_GUROBI)
+	{
+		GRBfreemodel(m->model);
+		m->model = NULL;
+		error = GRBnewmodel(m->env, &m->model, name, 0, NULL, NULL, NULL,
+			NULL, NULL);
+	}
+#ifdef HAVE_HIGHS
+	else
+		error = (Highs_clearModel(m->highs) == kHighsStatusError);
+#endif
+
+	free(m->sense);
+	free(m->start);
+	m->sense = NULL;
+	m->start = NULL;
+	m->rows = m->cols = m->started = 0;
+	m->status = 0;
+	m->objval = m->runtime = m->nodes = 0.0;
+
+	return error;
+}
+
+//FUNCTION
+//Name of the backend, for reports
+const char *solverName(SolverModel *m)
+{
+	return (m->backend == SOLVER_HIGHS) ? "HiGHS" : "Gurobi";
+}
+
+//FUNCTION
+//Message for the last failed call
+const char *solverError(SolverModel *m)
+{
+	if (m->backend == SOLVER_GUROBI && m->env)
+		return GRBgeterrormsg(m->env);
+	return "solver backend call failed";
+}
+
+//FUNCTION
+//Append count rows without coefficients, sense[i] being GRB_LESS_EQUAL,
+//	GRB_EQUAL or GRB_GREATER_EQUAL
+int solverAddRows(SolverModel *m, int count, char *sense, double *rhs)
+{
+	int error, *cbeg;
+
+	error = 0;
+	cbeg = (int *) calloc(count + 1, sizeof(int));
+
+	if (m->backend == SOLVER_GUROBI)
+	{
+		error = GRBaddconstrs(m->model, count, 0, cbeg, NULL, NULL, sense, rhs,
+			NULL);
+		if (!error)
+			error = GRBupdatemodel(m->model);
+	}
+#ifdef HAVE_HIGHS
+	else
+	{
+		double *lower, *upper;
+		int i;
+
+		lower = (double *) malloc(count * sizeof(double));
+		upper = (double *) malloc(count * sizeof(double));
+		for (i = 0; i < count; i++)
+		{
+			rowBounds(m, sense[i], rhs[i], &lower[i], &upper[i]);
+		}
+		error = (Highs_addRows(m->highs, count, lower, upper, 0, cbeg, NULL,
+			NULL) == kHighsStatusError);
+		free(lower);
+		free(upper);
+	}
+#endif
+
+	if (!error)
+	{
+		m->sense = (char *) realloc(m->sense, (m->rows + count) * sizeof(char));
+		memcpy(m->sense + m->rows, sense, count * sizeof(char));
+		m->rows += count;
+	}
+
+	free(cbeg);
+	return error;
+}
+
+//FUNCTION
+//Append count columns with lower bound 0, given in compressed sparse column
+//	form. upper may be NULL for no upper bound, vtype holds GRB_CONTINUOUS
+//	or GRB_BINARY per column
+int solverAddColumns(SolverModel *m, int count, int nz, int *vbeg, int *vind,
+	double *vval, double *obj, double *upper, char *vtype)
+{
+	int error;
+
+	error = 0;
+
+	if (m->backend == SOLVER_GUROBI)
+	{
+		error = GRBaddvars(m->model, count, nz, vbeg, vind, vval, obj, NULL,
+			upper, vtype, NULL);
+		if (!error)
+			error = GRBupdatemodel(m->model);
+	}
+#ifdef HAVE_HIGHS
+	else
+	{
+		double *lower, *bound;
+		int i, *integrality;
+
+		lower = (double *) calloc(count, sizeof(double));
+		bound = (double *) malloc(count * sizeof(double));
+		integrality = (int *) calloc(count, sizeof(int));
+		for (i = 0; i < count; i++)
+		{
+			bound[i] = columnUpper(m, upper ? upper[i] : SOLVER_INFINITY);
+			if (vtype && vtype[i] == GRB_BINARY)
+			{
+				bound[i] = 1.0;
+				integrality[i] = kHighsVarTypeInteger;
+			}
+		}
+		error = (Highs_addCols(m->highs, count, obj, lower, bound, nz, vbeg,
+			vind, vval) == kHighsStatusError);
+		if (!error)
+			error = (Highs_changeColsIntegralityByRange(m->highs, m->cols,
+				m->cols + count - 1, integrality) == kHighsStatusError);
+		free(lower);
+		free(bound);
+		free(integrality);
+	}
+#endif
+
+	if (!error)
+	{
+		m->start = (double *) realloc(m->start, (m->cols + count) *
+			sizeof(double));
+		memset(m->start + m->cols, 0, count * sizeof(double));
+		m->cols += count;
+	}
+
+	return error;
+}
+
+//FUNCTION
+//Replace the right hand sides of rows first to first + count - 1
+int solverSetRHS(SolverModel *m, int first, int count, double *rhs)
+{
+	if (m->backend == SOLVER_GUROBI)
+		return GRBsetdblattrarray(m->model, GRB_DBL_ATTR_RHS, first, count, rhs);
+
+#ifdef HAVE_HIGHS
+	{
+		double *lower, *upper;
+		int i, error;
+
+		lower = (double *) malloc(count * sizeof(double));
+		upper = (double *) malloc(count * sizeof(double));
+		for (i = 0; i < count; i++)
+		{
+			rowBounds(m, m->sense[first + i], rhs[i], &lower[i], &upper[i]);
+		}
+		error = (Highs_changeRowsBoundsByRange(m->highs, first,
+			first + count - 1, lower, upper) == kHighsStatusError);
+		free(lower);
+		free(upper);
+		return error;
+	}
+#endif
+	return 1;
+}
+
+//FUNCTION
+//Replace the upper bounds of columns first to first + count - 1, the lower
+//	bounds stay at 0
+int solverSetUpper(SolverModel *m, int first, int count, double *upper)
+{
+	if (m->backend == SOLVER_GUROBI)
+		return GRBsetdblattrarray(m->model, GRB_DBL_ATTR_UB, first, count,
+			upper);
+
+#ifdef HAVE_HIGHS
+	{
+		double *lower, *bound;
+		int i, error;
+
+		lower = (double *) calloc(count, sizeof(double));
+		bound = (double *) malloc(count * sizeof(double));
+		for (i = 0; i < count; i++)
+		{
+			bound[i] = columnUpper(m, upper[i]);
+		}
+		error = (Highs_changeColsBoundsByRange(m->highs, first,
+			first + count - 1, lower, bound) == kHighsStatusError);
+		free(lower);
+		free(bound);
+		return error;
+	}
+#endif
+	return 1;
+}
+
+//FUNCTION
+//Set the coefficients (cind[i], vind[i]) to cval[i]
+int solverChangeCoeffs(SolverModel *m, int count, int *cind, int *vind,
+	double *cval)
+{
+	if (m->backend == SOLVER_GUROBI)
+		return GRBchgcoeffs(m->model, count, cind, vind, cval);
+
+#ifdef HAVE_HIGHS
+	{
+		int i;
+
+		for (i = 0; i < count; i++)
+		{
+			if (Highs_changeCoeff(m->highs, cind[i], vind[i], cval[i]) ==
+				kHighsStatusError)
+				return 1;
+		}
+		return 0;
+	}
+#endif
+	return 1;
+}
+
+//FUNCTION
+//Start values for columns first to first + count - 1, used by the next
+//	solve. Gurobi takes them as a MIP start, HiGHS as a starting solution
+int solverSetStart(SolverModel *m, int first, int count, double *start)
+{
+	if (m->backend == SOLVER_GUROBI)
+		return GRBsetdblattrarray(m->model, GRB_DBL_ATTR_START, first, count,
+			start);
+
+	memcpy(m->start + first, start, count * sizeof(double));
+	m->started = 1;
+	return 0;
+}
+
+//FUNCTION
+//Solve LPs, and the relaxations of a MIP, with the dual simplex, which 
+//	restarts well after the right hand sides change. HiGHS already picks 
+//	the simplex for LPs, forcing its solver option would also solve a MIP 
+//	as its relaxation, so only the strategy is set
+int solverDualSimplex(SolverModel *m)
+{
+	if (m->backend == SOLVER_GUROBI)
+		return GRBsetintparam(GRBgetenv(m->model), GRB_INT_PAR_METHOD,
+			GRB_METHOD_DUAL);
+
+#ifdef HAVE_HIGHS
+	return (Highs_setIntOptionValue(m->highs, "simplex_strategy", 1) ==
+		kHighsStatusError);
+#endif
+	return 1;
+}
+
+//FUNCTION
+//Solve the model, filling status, objval, runtime and nodes. objval is 
+//	the objective of the best solution found, also when a limit stopped the
+//	solve early, and stays 0 if there is none
+int solverOptimize(SolverModel *m)
+{
+	int error, count;
+
+	m->status = GRB_LOADED;
+	m->objval = m->runtime = m->nodes = 0.0;
+
+	if (m->backend == SOLVER_GUROBI)
+	{
+		error = GRBoptimize(m->model);
+		if (!error)
+			error = GRBgetintattr(m->model, GRB_INT_ATTR_STATUS, &m->status);
+		if (!error)
+			GRBgetdblattr(m->model, GRB_DBL_ATTR_RUNTIME, &m->runtime);
+		//Only a MIP has a node count
+		if (!error)
+			GRBgetdblattr(m->model, GRB_DBL_ATTR_NODECOUNT, &m->nodes);
+		if (!error)
+			error = GRBgetintattr(m->model, GRB_INT_ATTR_SOLCOUNT, &count);
+		if (!error && count > 0)
+			error = GRBgetdblattr(m->model, GRB_DBL_ATTR_OBJVAL, &m->objval);
+		return error;
+	}
+
+#ifdef HAVE_HIGHS
+	HighsInt status;
+	int64_t nodes;
+	
+	if (m->started)
+	{
+		Highs_setSolution(m->highs, m->start, NULL, NULL, NULL);
+		m->started = 0;
+	}
+
+	if (Highs_run(m->highs) == kHighsStatusError)
+		return 1;
+
+	//The HiGHS status constants are not constant expressions in C, so no
+	//	switch. Anything else is left as not solved
+	status = Highs_getModelStatus(m->highs);
+	if (status == kHighsModelStatusOptimal)
+		m->status = GRB_OPTIMAL;
+	else if (status == kHighsModelStatusInfeasible)
+		m->status = GRB_INFEASIBLE;
+	else if (status == kHighsModelStatusUnbounded)
+		m->status = GRB_UNBOUNDED;
+	else if (status == kHighsModelStatusUnboundedOrInfeasible)
+		m->status = GRB_INF_OR_UNBD;
+	else if (status == kHighsModelStatusTimeLimit)
+		m->status = GRB_TIME_LIMIT;
+	else if (status == kHighsModelStatusIterationLimit)
+		m->status = GRB_ITERATION_LIMIT;
+	m->runtime = Highs_getRunTime(m->highs);
+	if (Highs_getInt64InfoValue(m->highs, "mip_node_count", &nodes) ==
+		kHighsStatusOk && nodes > 0)
+		m->nodes = (double) nodes;
+	if (Highs_getIntInfoValue(m->highs, "primal_solution_status", &status) ==
+		kHighsStatusOk && status == kHighsSolutionStatusFeasible)
+		m->objval = Highs_getObjectiveValue(m->highs);
+	return 0;
+#endif
+	return 1;
+}
+
+//FUNCTION
+//Values of columns first to first + count - 1 in the last solution
+int solverGetX(SolverModel *m, int first, int count, double *x)
+{
+	if (m->backend == SOLVER_GUROBI)
+		return GRBgetdblattrarray(m->model, GRB_DBL_ATTR_X, first, count, x);
+
+#ifdef HAVE_HIGHS
+	{
+		double *columns, *columnDuals, *rowValues, *rowDuals;
+		int error;
+
+		columns = (double *) malloc(m->cols * sizeof(double));
+		columnDuals = (double *) malloc(m->cols * sizeof(double));
+		rowValues = (double *) malloc(m->rows * sizeof(double));
+		rowDuals = (double *) malloc(m->rows * sizeof(double));
+
+		error = (Highs_getSolution(m->highs, columns, columnDuals, rowValues,
+			rowDuals) == kHighsStatusError);
+		if (!error)
+			memcpy(x, columns + first, count * sizeof(double));
+
+		free(columns);
+		free(columnDuals);
+		free(rowValues);
+		free(rowDuals);
+		return error;
+	}
+#endif
+	return 1;
+}
+
+//FUNCTION
+//Write the model, or with a .sol name the last solution, to file
+int solverWrite(SolverModel *m, const char *file)
+{
+	size_t length;
+
+	if (m->backend == SOLVER_GUROBI)
+		return GRBwrite(m->model, file);
+
+	length = strlen(file);
+#ifdef HAVE_HIGHS
+	if (length > 4 && strcmp(file + length - 4, ".sol") == 0)
+		return (Highs_writeSolutionPretty(m->highs, file) == kHighsStatusError);
+	return (Highs_writeModel(m->highs, file) == kHighsStatusError);
+#endif
+	return (length == 0);
+}
+
+//FUNCTION
+//Release the model and its environment
+void closeSolver(SolverModel *m)
+{
+	if (m->model)
+		GRBfreemodel(m->model);
+	if (m->env)
+		GRBfreeenv(m->env);
+#ifdef HAVE_HIGHS
+	if (m->highs)
+		Highs_destroy(m->highs);
+#endif
+	free(m->sense);
+	free(m->start);
+	memset(m, 0, sizeof(SolverModel));
+}
@@ -0,0 +1,54 @@
+#ifndef L1_SOLVER_H
+#define L1_SOLVER_H
+
+#include "gurobi_c.h"
+
+//LP/MIP backend behind the L1 models. A model is built as empty rows and
+//	then columns in compressed sparse column form, and afterwards only its
+//	right hand sides, bounds, coefficients and starts are changed. Each
+//	backend keeps its basis between solves, so a changed model is warm
+//	started. Statuses are reported as Gurobi status codes, whichever
+//	backend solved the model. Gurobi is always built in, HiGHS when
+//	compiled with -DHAVE_HIGHS. Gurobi only features, such as SOS1 and 
+//	indicator constraints, the solution pool or hints, are set on model
+//	directly when backend is SOLVER_GUROBI
+
+#define SOLVER_GUROBI 0
+#define SOLVER_HIGHS 1
+
+//Bounds at or above this are infinite for every backend
+#define SOLVER_INFINITY GRB_INFINITY
+
+typedef struct
+{
+	int backend;
+	int rows, cols;
+	GRBenv *env;
+	GRBmodel *model;
+	void *highs; //HiGHS instance
+	char *sense; //Row senses, HiGHS stores rows as lower and upper bounds
+	double *start; //Column starts handed to HiGHS at the next solve
+	int started;
+	int status; //Gurobi status code of the last solve
+	double objval, runtime;
+	double nodes; //Branch and bound nodes of the last MIP solve
+} SolverModel;
+
+int openSolver(SolverModel *, int, const char *, const char *);
+int clearSolver(SolverModel *, const char *);
+const char *solverName(SolverModel *);
+const char *solverError(SolverModel *);
+int solverAddRows(SolverModel *, int, char *, double *);
+int solverAddColumns(SolverModel *, int, int, int *, int *, double *,
+	double *, double *, char *);
+int solverSetRHS(SolverModel *, int, int, double *);
+int solverSetUpper(SolverModel *, int, int, double *);
+int solverChangeCoeffs(SolverModel *, int, int *, int *, double *);
+int solverSetStart(SolverModel *, int, int, double *);
+int solverDualSimplex(SolverModel *);
+int solverOptimize(SolverModel *);
+int solverGetX(SolverModel *, int, int, double *);
+int solverWrite(SolverModel *, const char *);
+void closeSolver(SolverModel *);
+
+#endif